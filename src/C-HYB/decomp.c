@@ -0,0 +1,458 @@
+/*  Block decomposition of the image with halo exchange.
+ *
+ *  In the replicated-data version every process holds the whole image
+ *  several times over, receives all of it in an MPI_Bcast and takes
+ *  part in an MPI_Reduce of the whole convolution, so neither memory
+ *  nor communication per process falls as processes are added.
+ *
+ *  Here the image is instead divided into blocks over a two-dimensional
+ *  grid of processes, created with MPI_Cart_create. The master process
+ *  reads the image, packs each process's block contiguously and sends
+ *  it with MPI_Scatterv. To convolve its block a process also needs a
+ *  halo d pixels wide around it, which it swaps with its neighbours in
+ *  the grid using MPI_Sendrecv: first along j, for the rows it owns,
+ *  and then along i for whole rows including the halo just received,
+ *  which fills in the corners. The image is padded with zeros as before,
+ *  which at the edges of the image is done by exchanging with
+ *  MPI_PROC_NULL. Each process then sharpens only the pixels it owns and
+ *  returns them to the master with MPI_Gatherv.
+ *
+ *  A block of nxl x nyl pixels has a halo of (nxl+2d)*(nyl+2d)-nxl*nyl
+ *  pixels. Strips of the whole image (a grid of P x 1) have a halo of
+ *  about 2d*ny however many processes there are, whereas a square grid
+ *  has one of about 4d*sqrt(nx*ny/P), so by default the shape of the
+ *  grid is chosen to give the largest block the smallest halo. It can
+ *  be set instead with SHARPEN_GRID=PxQ, where a zero leaves that
+ *  dimension to MPI_Dims_create.
+ *
+ *  As the halo comes from the neighbouring blocks only, each block must
+ *  be at least d pixels wide in both directions.
+ *
+ *  In the hybrid version the pixels of each block are shared among the
+ *  threads with an OpenMP loop. The terms of the convolution are added
+ *  up in the same order as in dosharpen.c, so the results are identical.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#include "utilities.h"
+#include "sharpen.h"
+
+static char *decompnames[] = {"replicated", "block"};
+
+#define NDECOMP (int) (sizeof(decompnames)/sizeof(decompnames[0]))
+
+/*
+ *  The decomposition chosen with SHARPEN_DECOMP, replicated by default.
+ *  Stops if SHARPEN_GRID is set for the replicated decomposition, which
+ *  has no grid.
+ */
+
+int decompmode(void)
+{
+  char *value = getenv("SHARPEN_DECOMP");
+  char *grid  = getenv("SHARPEN_GRID");
+  int i;
+
+  if (NULL == value || 0 == strlen(value)) value = decompnames[DECOMP_REPLICATED];
+
+  for (i=0; i < NDECOMP; i++)
+    {
+      if (0 == strcmp(value, decompnames[i]))
+        {
+          if (i != DECOMP_BLOCK && NULL != grid && 0 != strlen(grid))
+            {
+              fprintf(stderr, "decompmode: SHARPEN_GRID=%s needs SHARPEN_DECOMP=block\n", grid);
+              exit(-1);
+            }
+
+          return i;
+        }
+    }
+
+  fprintf(stderr, "decompmode: unknown value SHARPEN_DECOMP=%s, valid values are:", value);
+  for (i=0; i < NDECOMP; i++) fprintf(stderr, " %s", decompnames[i]);
+  fprintf(stderr, "\n");
+
+  exit(-1);
+}
+
+/*
+ *  Values [*i0, *i1) of the n values owned by the process at position
+ *  coord of the np along one dimension of the grid
+ */
+
+static void decompblock(int n, int coord, int np, int *i0, int *i1)
+{
+  *i0 = (int) (((long) n*coord)/np);
+  *i1 = (int) (((long) n*(coord+1))/np);
+}
+
+/*
+ *  The halo of the largest block of a px x py grid, or -1 if the
+ *  smallest block is narrower than d in either direction
+ */
+
+static long decomphalo(int nx, int ny, int d, int px, int py)
+{
+  long nxl = (nx+px-1)/px;
+  long nyl = (ny+py-1)/py;
+
+  if (nx/px < d || ny/py < d) return -1;
+
+  return (nxl+2*d)*(nyl+2*d) - nxl*nyl;
+}
+
+/*
+ *  The shape of the grid of size processes. SHARPEN_GRID=PxQ fixes it,
+ *  with zeros chosen by MPI_Dims_create; otherwise every factorisation
+ *  of size is tried and that with the smallest halo is used.
+ */
+
+static void decompgrid(int size, int nx, int ny, int d, int dims[2])
+{
+  char *value = getenv("SHARPEN_GRID");
+  char *end;
+  long halo, best;
+  int px;
+
+  dims[0] = dims[1] = 0;
+
+  if (NULL != value && 0 != strlen(value))
+    {
+      dims[0] = (int) strtol(value, &end, 10);
+
+      if (*end == 'x') dims[1] = (int) strtol(end+1, &end, 10);
+
+      if (*end != '\0' || dims[0] < 0 || dims[1] < 0 ||
+          (dims[0] > 0 && size%dims[0] != 0) || (dims[1] > 0 && size%dims[1] != 0) ||
+          (dims[0] > 0 && dims[1] > 0 && dims[0]*dims[1] != size))
+        {
+          fprintf(stderr, "decompgrid: SHARPEN_GRID=%s is not of the form PxQ with P*Q = %d\n",
+                  value, size);
+          exit(-1);
+        }
+
+      MPI_Dims_create(size, 2, dims);
+
+      return;
+    }
+
+  best = -1;
+
+  for (px=1; px <= size; px++)
+    {
+      if (size%px != 0) continue;
+
+      halo = decomphalo(nx, ny, d, px, size/px);
+
+      if (halo >= 0 && (best < 0 || halo < best))
+        {
+          best = halo;
+          dims[0] = px;
+          dims[1] = size/px;
+        }
+    }
+
+  /* No grid is usable, so leave it to the check in sharpendecomp */
+
+  if (best < 0)
+    {
+      MPI_Dims_create(size, 2, dims);
+    }
+}
+
+/*
+ *  Sharpen the nx x ny image in infile and write the cropped result to
+ *  outfile, as dosharpen does, with sharp = fuzzy - factor*convolution.
+ */
+
+void sharpendecomp(char *infile, char *outfile, int nx, int ny, int d,
+                   double factor, MPI_Comm comm)
+{
+  MPI_Comm cart;
+  MPI_Datatype halo;
+
+  int dims[2], periods[2], coords[2];
+  int rank, size, lo, hi;
+  int xpix, ypix, i0, i1, j0, j1, nxl, nyl, nxp, nyp, nw, r;
+  int i, j, k, l;
+  long p;
+
+  int *counts, *displs;
+  int *fuzzy, *packed, *block;
+  double *padded, *sharp, *sharpAll, *sharpCropped, *w;
+  double conv, tstart, tstop, time;
+
+  MPI_Comm_size(comm, &size);
+
+  nw = 2*d+1;
+
+  decompgrid(size, nx, ny, d, dims);
+
+  /* Processes may be renumbered to suit the machine, so use the new ranks */
+
+  periods[0] = periods[1] = 0;
+
+  MPI_Cart_create(comm, 2, dims, periods, 1, &cart);
+  MPI_Comm_rank(cart, &rank);
+  MPI_Cart_coords(cart, rank, 2, coords);
+
+  if (nx/dims[0] < d || ny/dims[1] < d)
+    {
+      if (rank == 0)
+        {
+          printf("Error: blocks of %d x %d pixels on a %d x %d grid are narrower than the filter range %d\n",
+                 nx/dims[0], ny/dims[1], dims[0], dims[1], d);
+        }
+      fflush(stdout);
+
+      MPI_Finalize();
+      exit(-1);
+    }
+
+  decompblock(nx, coords[0], dims[0], &i0, &i1);
+  decompblock(ny, coords[1], dims[1], &j0, &j1);
+
+  nxl = i1-i0;
+  nyl = j1-j0;
+  nxp = nxl+2*d;
+  nyp = nyl+2*d;
+
+  /* Only the master holds the whole image, to read and write it */
+
+  fuzzy = NULL;
+  packed = NULL;
+  sharpAll = NULL;
+  counts = NULL;
+  displs = NULL;
+
+  if (rank == 0)
+    {
+      fuzzy    = (int *) malloc((long) nx*ny*sizeof(int));
+      packed   = (int *) malloc((long) nx*ny*sizeof(int));
+      sharpAll = (double *) malloc((long) nx*ny*sizeof(double));
+      counts   = (int *) malloc(size*sizeof(int));
+      displs   = (int *) malloc(size*sizeof(int));
+
+      if (NULL == fuzzy || NULL == packed || NULL == sharpAll || NULL == counts || NULL == displs)
+        {
+          fprintf(stderr, "sharpendecomp: cannot allocate %d x %d image\n", nx, ny);
+          MPI_Abort(cart, -1);
+        }
+    }
+
+  block  = (int *) malloc((long) nxl*nyl*sizeof(int));
+  padded = (double *) calloc((long) nxp*nyp, sizeof(double));
+  sharp  = (double *) malloc((long) nxl*nyl*sizeof(double));
+
+  if (NULL == block || NULL == padded || NULL == sharp)
+    {
+      fprintf(stderr, "sharpendecomp: cannot allocate block of %d x %d pixels\n", nxl, nyl);
+      MPI_Abort(cart, -1);
+    }
+
+  if (rank == 0)
+    {
+      printf("Using a filter of size %d x %d\n", nw, nw);
+      printf("Using a block decomposition over a %d x %d grid of processes\n", dims[0], dims[1]);
+      printf("\n");
+
+      printf("Reading image file: %s\n", infile);
+      fflush(stdout);
+
+      pgmread(infile, fuzzy, nx, ny, &xpix, &ypix);
+      printf("... done\n\n");
+      fflush(stdout);
+    }
+
+  MPI_Bcast(&xpix, 1, MPI_INT, 0, cart);
+  MPI_Bcast(&ypix, 1, MPI_INT, 0, cart);
+
+  if (xpix == 0 || ypix == 0 || nx != xpix || ny != ypix)
+    {
+      if (rank == 0) printf("Error reading %s\n", infile);
+      fflush(stdout);
+
+      MPI_Finalize();
+      exit(-1);
+    }
+
+  /* The master packs the blocks contiguously in rank order and sends them */
+
+  if (rank == 0)
+    {
+      p = 0;
+
+      for (r=0; r < size; r++)
+        {
+          MPI_Cart_coords(cart, r, 2, coords);
+          decompblock(nx, coords[0], dims[0], &i0, &i1);
+          decompblock(ny, coords[1], dims[1], &j0, &j1);
+
+          counts[r] = (i1-i0)*(j1-j0);
+          displs[r] = (int) p;
+
+          for (i=i0; i < i1; i++)
+            {
+              for (j=j0; j < j1; j++)
+                {
+                  packed[p++] = fuzzy[(long) i*ny+j];
+                }
+            }
+        }
+    }
+
+  MPI_Scatterv(packed, counts, displs, MPI_INT, block, nxl*nyl, MPI_INT, 0, cart);
+
+  for (i=0; i < nxl; i++)
+    {
+      for (j=0; j < nyl; j++)
+        {
+          padded[(long) (i+d)*nyp+(j+d)] = block[(long) i*nyl+j];
+        }
+    }
+
+  free(block);
+
+  /*
+   *  Swap halos with the neighbouring blocks. Along j the halo is d
+   *  columns of each row owned, described by a vector type. Along i it
+   *  is d whole rows, so is contiguous, and as these include the j
+   *  halos the corners come with them. Processes at the edges of the
+   *  image keep the zeros they started with.
+   */
+
+  MPI_Type_vector(nxl, d, nyp, MPI_DOUBLE, &halo);
+  MPI_Type_commit(&halo);
+
+  MPI_Cart_shift(cart, 1, 1, &lo, &hi);
+
+  MPI_Sendrecv(&padded[(long) d*nyp+d],       1, halo, lo, 0,
+               &padded[(long) d*nyp+nyl+d],   1, halo, hi, 0,
+               cart, MPI_STATUS_IGNORE);
+
+  MPI_Sendrecv(&padded[(long) d*nyp+nyl],     1, halo, hi, 1,
+               &padded[(long) d*nyp],         1, halo, lo, 1,
+               cart, MPI_STATUS_IGNORE);
+
+  MPI_Type_free(&halo);
+
+  MPI_Cart_shift(cart, 0, 1, &lo, &hi);
+
+  MPI_Sendrecv(&padded[(long) d*nyp],         d*nyp, MPI_DOUBLE, lo, 2,
+               &padded[(long) (nxl+d)*nyp],   d*nyp, MPI_DOUBLE, hi, 2,
+               cart, MPI_STATUS_IGNORE);
+
+  MPI_Sendrecv(&padded[(long) nxl*nyp],       d*nyp, MPI_DOUBLE, hi, 3,
+               &padded[0],                    d*nyp, MPI_DOUBLE, lo, 3,
+               cart, MPI_STATUS_IGNORE);
+
+  if (rank == 0) printf("Starting calculation ...\n");
+
+  MPI_Barrier(cart);
+
+  /* Print out current core and node location. */
+#pragma omp parallel
+{
+  printlocation();
+}
+
+  tstart = MPI_Wtime();
+
+  w = getfilter(d)->w;
+
+#pragma omp parallel for default(none) \
+  shared(nxl, nyl, nyp, d, nw, w, padded, sharp, factor) \
+  private(i, j, k, l, conv)
+  for (i=0; i < nxl; i++)
+    {
+      for (j=0; j < nyl; j++)
+        {
+          conv = 0.0;
+
+          for (k=-d; k <= d; k++)
+            {
+              for (l= -d; l <= d; l++)
+                {
+                  conv = conv + w[(k+d)*nw+(l+d)]*padded[(long) (i+d+k)*nyp+(j+d+l)];
+                }
+            }
+
+          sharp[(long) i*nyl+j] = padded[(long) (i+d)*nyp+(j+d)] - factor*conv;
+        }
+    }
+
+  MPI_Barrier(cart);
+
+  tstop = MPI_Wtime();
+  time = tstop - tstart;
+
+  if (rank == 0)
+    {
+      printf("... finished\n");
+      printf("\n");
+      fflush(stdout);
+    }
+
+  /* Return each block to the master, which puts them back in place */
+
+  MPI_Gatherv(sharp, nxl*nyl, MPI_DOUBLE, sharpAll, counts, displs, MPI_DOUBLE, 0, cart);
+
+  if (rank == 0)
+    {
+      printf("Writing output file: %s\n", outfile);
+      printf("\n");
+
+      /* Only save the core of the sharpened image to remove edge effects */
+
+      sharpCropped = (double *) malloc((long) (nx-2*d)*(ny-2*d)*sizeof(double));
+
+      if (NULL == sharpCropped)
+        {
+          fprintf(stderr, "sharpendecomp: cannot allocate %d x %d image\n", nx-2*d, ny-2*d);
+          MPI_Abort(cart, -1);
+        }
+
+      for (r=0; r < size; r++)
+        {
+          MPI_Cart_coords(cart, r, 2, coords);
+          decompblock(nx, coords[0], dims[0], &i0, &i1);
+          decompblock(ny, coords[1], dims[1], &j0, &j1);
+
+          p = displs[r];
+
+          for (i=i0; i < i1; i++)
+            {
+              for (j=j0; j < j1; j++, p++)
+                {
+                  if (i >= d && i < nx-d && j >= d && j < ny-d)
+                    {
+                      sharpCropped[(long) (i-d)*(ny-2*d)+(j-d)] = sharpAll[p];
+                    }
+                }
+            }
+        }
+
+      pgmwrite(outfile, sharpCropped, nx-2*d, ny-2*d);
+
+      printf("... done\n");
+      printf("\n");
+      printf("Calculation time was %f seconds\n", time);
+      fflush(stdout);
+
+      free(sharpCropped);
+      free(fuzzy);
+      free(packed);
+      free(sharpAll);
+      free(counts);
+      free(displs);
+    }
+
+  free(padded);
+  free(sharp);
+
+  MPI_Comm_free(&cart);
+}
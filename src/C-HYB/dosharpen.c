@@ -14,6 +14,14 @@
  *  process. Finally the master process adds the convolution result to
  *  the fuzzy image and writes the resulting sharp image to file.
  *
+ *  Setting SHARPEN_SCHEDULE=steal replaces the cyclic distribution:
+ *  each process takes a contiguous block of tiles of the image, which
+ *  its threads share out by work stealing (see steal.c).
+ *
+ *  Setting SHARPEN_DECOMP=block instead divides the image into blocks
+ *  over a 2-D grid of processes, with halos swapped between neighbours
+ *  (see decomp.c).
+ *
  *  David Henty, EPCC, September 2009
  *  Arno Proeme, EPCC, March 2013 (minor modifications)
  *  Dominic Sloan-Murphy, EPCC, November 2013 (more minor modifications)
@@ -22,11 +30,72 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <mpi.h>
 #include <omp.h>
 #include "utilities.h"
 #include "sharpen.h"
 
+/* Size of the tiles used with SHARPEN_SCHEDULE=steal */
+
+#define STEALTILEI 16
+#define STEALTILEJ 64
+
+/*
+ *  True if SHARPEN_SCHEDULE=steal, false if it is unset or cyclic
+ */
+
+static int schedulesteal(void)
+{
+  char *value = getenv("SHARPEN_SCHEDULE");
+
+  if (NULL == value || 0 == strlen(value) || 0 == strcmp(value, "cyclic")) return 0;
+
+  if (0 == strcmp(value, "steal")) return 1;
+
+  fprintf(stderr, "schedulesteal: unknown value SHARPEN_SCHEDULE=%s, valid values are: cyclic steal\n", value);
+  exit(-1);
+}
+
+/*
+ *  Convolution of one tile into the partial result of this process
+ */
+
+typedef struct
+{
+  double *w, *padded, *conv;
+  int nx, ny, d;
+} hybridtiles;
+
+static void hybridtile(void *arg, int t, int thread)
+{
+  hybridtiles *ht = (hybridtiles *) arg;
+  int d = ht->d;
+  int nyp = ht->ny + 2*d;
+  int i, j, k, l, i0, i1, j0, j1;
+  double sum;
+
+  stealtilebounds(t, ht->nx, ht->ny, STEALTILEI, STEALTILEJ, &i0, &i1, &j0, &j1);
+
+  for (i=i0; i < i1; i++)
+    {
+      for (j=j0; j < j1; j++)
+        {
+          sum = ht->conv[(long) i*ht->ny+j];
+
+          for (k=-d; k <= d; k++)
+            {
+              for (l= -d; l <= d; l++)
+                {
+                  sum = sum + ht->w[(k+d)*(2*d+1)+(l+d)]*ht->padded[(long) (i+d+k)*nyp + (j+d+l)];
+                }
+            }
+
+          ht->conv[(long) i*ht->ny+j] = sum;
+        }
+    }
+}
+
 void dosharpen(char *infile, int nx, int ny, MPI_Comm comm)
 {
   int        d = 8; 
@@ -44,8 +113,48 @@ void dosharpen(char *infile, int nx, int ny, MPI_Comm comm)
   int globalsize, globalid;
 
   int i, j, k, l;
+  double *w;
   double tstart, tstop, time;
 
+  int steal = schedulesteal();
+  int ntile, r;
+  hybridtiles ht;
+  stealstats stats[omp_get_max_threads()]; /* Tiles computed and stolen by each thread of this process with SHARPEN_SCHEDULE=steal */
+  stealstats *statsAll = NULL;
+  int *threadsAll = NULL, *counts = NULL, *displs = NULL;
+  int ntotal;
+
+  MPI_Comm_size(comm, &size);
+  MPI_Comm_rank(comm, &rank);
+
+  if (2*d >= nx || 2*d >= ny)
+    {
+      if (rank == 0) printf("Error: a %d x %d image is too small for a filter of range %d\n", nx, ny, d);
+      fflush(stdout);
+
+      MPI_Finalize();
+      exit(-1);
+    }
+
+  /* Return before the whole-image arrays below are allocated on every process */
+
+  if (decompmode() == DECOMP_BLOCK)
+    {
+      /* The threads of each process share its block with an OpenMP loop, not by stealing */
+      if (steal)
+        {
+          if (rank == 0) printf("Error: SHARPEN_SCHEDULE=steal cannot be used with SHARPEN_DECOMP=block\n");
+          fflush(stdout);
+
+          MPI_Finalize();
+          exit(-1);
+        }
+
+      sharpendecomp(infile, "sharpened.pgm", nx, ny, d, scale/norm, comm);
+      freefilterbanks();
+      return;
+    }
+
   int fuzzy[nx][ny];                   /* Will store the fuzzy input image when it is first read in from file                                     */
   double fuzzyPadded[nx+2*d][ny+2*d];  /* Will store the fuzzy input image plus additional border padding                                         */
   double convolutionPartial[nx][ny];   /* Will store the convolution of the filter with parts of the fuzzy image computed by individual processes */
@@ -55,9 +164,6 @@ void dosharpen(char *infile, int nx, int ny, MPI_Comm comm)
   
   char *outfile = "sharpened.pgm";
 
-  MPI_Comm_size(comm, &size);
-  MPI_Comm_rank(comm, &rank);
-
   /* Initialise image arrays */
   for (i=0; i < nx; i++)
     {
@@ -65,12 +171,14 @@ void dosharpen(char *infile, int nx, int ny, MPI_Comm comm)
         {
           fuzzy[i][j] = 0;        
           sharp[i][j] = 0.0;
+          convolutionPartial[i][j] = 0.0;
         }
     }
 
   if (rank == 0)
     {
       printf("Using a filter of size %d x %d\n", 2*d+1, 2*d+1);
+      if (steal) printf("Stealing tiles of %d x %d pixels within each process\n", STEALTILEI, STEALTILEJ);
       printf("\n");
 
       printf("Reading image file: %s\n", infile);
@@ -126,8 +234,28 @@ void dosharpen(char *infile, int nx, int ny, MPI_Comm comm)
 
   tstart = MPI_Wtime();
 
+  /* Use the precomputed coefficients rather than calling filter() for every tap */
+  w = getfilter(d)->w;
+
+  if (steal)
+    {
+      /* Each process takes a contiguous block of tiles for its threads to share */
+      ht.w = w;
+      ht.padded = &fuzzyPadded[0][0];
+      ht.conv = &convolutionPartial[0][0];
+      ht.nx = nx;
+      ht.ny = ny;
+      ht.d  = d;
+
+      ntile = stealtilecount(nx, ny, STEALTILEI, STEALTILEJ);
+
+      nthreads = stealrun((int) (((long) ntile*rank)/size), (int) (((long) ntile*(rank+1))/size),
+                          hybridtile, &ht, stats);
+    }
+  else
+    {
 #pragma omp parallel default(none) \
-  shared(nx, ny, d, convolutionPartial, fuzzyPadded, rank, size) \
+  shared(nx, ny, d, w, convolutionPartial, fuzzyPadded, rank, size) \
   private(i, j, k, l, pixcount, nthreads, threadid, globalsize, globalid)
 {
 
@@ -151,7 +279,7 @@ void dosharpen(char *infile, int nx, int ny, MPI_Comm comm)
                 {
                   for (l= -d; l <= d; l++)
                     {
-                      convolutionPartial[i][j] = convolutionPartial[i][j] + filter(d,k,l)*fuzzyPadded[i+d+k][j+d+l];
+                      convolutionPartial[i][j] = convolutionPartial[i][j] + w[(k+d)*(2*d+1)+(l+d)]*fuzzyPadded[i+d+k][j+d+l];
                     }
                 }
             }
@@ -159,6 +287,7 @@ void dosharpen(char *infile, int nx, int ny, MPI_Comm comm)
         }
     }
 }  
+    }
 
   MPI_Barrier(comm);
 
@@ -172,6 +301,65 @@ void dosharpen(char *infile, int nx, int ny, MPI_Comm comm)
       fflush(stdout);
     }
 
+  if (steal)
+    {
+      /* Report what every thread of every process did. The processes
+         need not all have the same number of threads, so gather the
+         numbers first to know where the statistics of each one go */
+      if (rank == 0)
+        {
+          threadsAll = (int *) malloc(size*sizeof(int));
+          counts     = (int *) malloc(size*sizeof(int));
+          displs     = (int *) malloc(size*sizeof(int));
+
+          if (NULL == threadsAll || NULL == counts || NULL == displs)
+            {
+              fprintf(stderr, "dosharpen: cannot allocate statistics\n");
+              MPI_Abort(comm, -1);
+            }
+        }
+
+      MPI_Gather(&nthreads, 1, MPI_INT, threadsAll, 1, MPI_INT, 0, comm);
+
+      if (rank == 0)
+        {
+          ntotal = 0;
+
+          for (r=0; r < size; r++)
+            {
+              counts[r] = threadsAll[r]*sizeof(stealstats);
+              displs[r] = ntotal*sizeof(stealstats);
+              ntotal += threadsAll[r];
+            }
+
+          statsAll = (stealstats *) malloc((long) ntotal*sizeof(stealstats));
+
+          if (NULL == statsAll)
+            {
+              fprintf(stderr, "dosharpen: cannot allocate statistics\n");
+              MPI_Abort(comm, -1);
+            }
+        }
+
+      MPI_Gatherv(stats, nthreads*sizeof(stealstats), MPI_BYTE,
+                  statsAll, counts, displs, MPI_BYTE, 0, comm);
+
+      if (rank == 0)
+        {
+          for (r=0; r < size; r++)
+            {
+              printf("Process %d\n", r);
+              stealreport(&statsAll[displs[r]/sizeof(stealstats)], threadsAll[r]);
+            }
+
+          fflush(stdout);
+          free(statsAll);
+          free(threadsAll);
+          free(counts);
+          free(displs);
+        }
+    }
+
   /* Gather the partial convolution results computed by individual processes */
   MPI_Reduce(convolutionPartial, convolution, nx*ny, MPI_DOUBLE, MPI_SUM, 0, comm);
   
@@ -206,4 +394,6 @@ void dosharpen(char *infile, int nx, int ny, MPI_Comm comm)
       printf("Calculation time was %f seconds\n", time);
       fflush(stdout);      
     }
+
+  freefilterbanks();
 }
@@ -1,19 +1,30 @@
 #include <math.h>
 
-double filter(int d, int i, int j)
-{
-  double rd4sq, rsq, sigmad4sq, sigmasq, x, y, delta;
+/*
+ *  The width of the Gaussian scales with the range of the filter: it
+ *  is SIGMAD4 for a filter of range D4, and proportionally wider or
+ *  narrower for other ranges. FILTER0 is the value at the origin.
+ */
+
+#define D4      4
+#define SIGMAD4 1.4
+#define FILTER0 -40.0
 
-  int d4 = 4;
+double filtersigma(int d)
+{
+  return SIGMAD4 * ((double) d / (double) D4);
+}
 
-  double sigmad4 = 1.4;
-  double filter0 = -40.0;
+double filterpeak(void)
+{
+  return FILTER0;
+}
 
-  rd4sq = d4*d4;
-  rsq   = d*d;
+double filterfunc(double sigma, double filter0, int i, int j)
+{
+  double rsq, sigmasq, x, y, delta;
 
-  sigmad4sq = sigmad4*sigmad4;
-  sigmasq   = sigmad4sq * (rsq/rd4sq);
+  sigmasq = sigma*sigma;
 
   x = (double) i;
   y = (double) j;
@@ -24,3 +35,8 @@ double filter(int d, int i, int j)
 
   return(filter0 * (1.0-delta) * exp(-delta));
 }
+
+double filter(int d, int i, int j)
+{
+  return filterfunc(filtersigma(d), filterpeak(), i, j);
+}
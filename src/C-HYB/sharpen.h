@@ -1,6 +1,52 @@
+#include <mpi.h>
+
 void pgmsize(char *filename, int *nx, int *ny);
 void pgmread(char *filename, void *vp, int nxmax, int nymax, int *nx, int *ny);
 void pgmwrite(char *filename, void *vx, int nx, int ny);
 
 void dosharpen(char *filename, int nx, int ny, MPI_Comm comm);
 double filter(int d, int i, int j);
+
+/* Block decomposition with halo exchange, see decomp.c */
+
+#define DECOMP_REPLICATED 0
+#define DECOMP_BLOCK      1
+
+int decompmode(void);
+void sharpendecomp(char *infile, char *outfile, int nx, int ny, int d,
+                   double factor, MPI_Comm comm);
+
+/* Precomputed filter coefficients, see filterbank.c */
+
+typedef struct
+{
+  int d;
+  double sigma, filter0;
+  double *w;
+  float *wf;
+} filterbank;
+
+double filtersigma(int d);
+double filterpeak(void);
+double filterfunc(double sigma, double filter0, int i, int j);
+
+filterbank *getfilterbank(int d, double sigma, double filter0);
+filterbank *getfilter(int d);
+void freefilterbanks(void);
+
+/* Work-stealing scheduler for tiles, see steal.c */
+
+typedef void (*stealtask)(void *arg, int tile, int thread);
+
+typedef struct
+{
+  long tiles;
+  long steals;
+  long attempts;
+  double busy;
+} stealstats;
+
+int stealrun(int first, int last, stealtask task, void *arg, stealstats *stats);
+void stealreport(stealstats *stats, int nthread);
+int stealtilecount(int nx, int ny, int ti, int tj);
+void stealtilebounds(int t, int nx, int ny, int ti, int tj, int *i0, int *i1, int *j0, int *j1);
@@ -0,0 +1,328 @@
+/*  Work-stealing scheduler for tiles of uneven cost.
+ *
+ *  Static schedules fix in advance which thread computes which tile,
+ *  so the slowest thread sets the time whenever the cost of the tiles
+ *  is not known beforehand. OpenMP's dynamic schedule balances the work
+ *  but every thread takes every chunk from one shared counter.
+ *
+ *  Here each thread starts with a contiguous block of the tiles in a
+ *  deque of its own, and works through it from the bottom. A thread
+ *  that runs out picks another thread at random and steals a tile from
+ *  the top of its deque, the end its owner will reach last. While all
+ *  the threads are busy none of them touches another's deque, so the
+ *  only contention is at the end of the calculation.
+ *
+ *  The deques are the lock-free ones of Chase and Lev, with the memory
+ *  orderings given by Le, Pop, Cohen and Zappa Nardelli (PPoPP 2013)
+ *  for C11 atomics. Since all the tiles are in place before any are
+ *  taken, the deques never need to grow.
+ *
+ *  Each task is a call task(arg, tile, thread), where thread can be
+ *  used to index per-thread work space.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <omp.h>
+#include "sharpen.h"
+
+#define CACHELINE 64
+
+/* Returned by stealpop and stealtake when there is no tile */
+
+#define NOTILE    -1
+#define LOSTRACE  -2
+
+typedef struct
+{
+  _Atomic long top;
+  char padtop[CACHELINE-sizeof(long)];
+
+  _Atomic long bottom;
+  char padbottom[CACHELINE-sizeof(long)];
+
+  _Atomic int *tiles;
+  long capacity;
+} stealdeque;
+
+/*
+ *  Used only by the owner, before any other thread can see the deque
+ */
+
+static void stealpush(stealdeque *q, int tile)
+{
+  long b = atomic_load_explicit(&q->bottom, memory_order_relaxed);
+
+  atomic_store_explicit(&q->tiles[b % q->capacity], tile, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&q->bottom, b+1, memory_order_relaxed);
+}
+
+/*
+ *  The owner takes the tile at the bottom. Only when a single tile is
+ *  left can it race with a thief, which is settled on top.
+ */
+
+static int stealpop(stealdeque *q)
+{
+  long b, t;
+  int tile;
+
+  b = atomic_load_explicit(&q->bottom, memory_order_relaxed) - 1;
+  atomic_store_explicit(&q->bottom, b, memory_order_relaxed);
+
+  atomic_thread_fence(memory_order_seq_cst);
+
+  t = atomic_load_explicit(&q->top, memory_order_relaxed);
+
+  if (t > b)
+  {
+    atomic_store_explicit(&q->bottom, b+1, memory_order_relaxed);
+    return NOTILE;
+  }
+
+  tile = atomic_load_explicit(&q->tiles[b % q->capacity], memory_order_relaxed);
+
+  if (t == b)
+  {
+    if (!atomic_compare_exchange_strong_explicit(&q->top, &t, t+1,
+                                                 memory_order_seq_cst, memory_order_relaxed))
+    {
+      tile = NOTILE;
+    }
+
+    atomic_store_explicit(&q->bottom, b+1, memory_order_relaxed);
+  }
+
+  return tile;
+}
+
+/*
+ *  A thief takes the tile at the top, or returns LOSTRACE if another
+ *  thread took it first.
+ */
+
+static int stealtake(stealdeque *q)
+{
+  long b, t;
+  int tile;
+
+  t = atomic_load_explicit(&q->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+
+  if (t >= b) return NOTILE;
+
+  tile = atomic_load_explicit(&q->tiles[t % q->capacity], memory_order_relaxed);
+
+  if (!atomic_compare_exchange_strong_explicit(&q->top, &t, t+1,
+                                               memory_order_seq_cst, memory_order_relaxed))
+  {
+    return LOSTRACE;
+  }
+
+  return tile;
+}
+
+/*
+ *  A small random number generator for choosing victims, so that
+ *  threads do not contend for the state of rand()
+ */
+
+static unsigned int stealrandom(unsigned int *state)
+{
+  unsigned int x = *state;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+
+  *state = x;
+
+  return x;
+}
+
+/*
+ *  Run task for tiles first <= tile < last on all the threads of a new
+ *  parallel region, returning in stats[thread] what each thread did.
+ *  stats must have room for omp_get_max_threads() entries, and the
+ *  number of threads used is returned.
+ */
+
+int stealrun(int first, int last, stealtask task, void *arg, stealstats *stats)
+{
+  stealdeque *deques;
+  _Atomic long remaining;
+  int nthread;
+
+  nthread = omp_get_max_threads();
+
+  deques = (stealdeque *) aligned_alloc(CACHELINE, nthread*sizeof(stealdeque));
+
+  if (NULL == deques)
+  {
+    fprintf(stderr, "stealrun: cannot allocate %d deques\n", nthread);
+    exit(-1);
+  }
+
+  atomic_init(&remaining, last-first);
+
+#pragma omp parallel shared(deques, remaining, nthread, first, last, task, arg, stats)
+  {
+    stealdeque *q;
+    stealstats *s;
+    double tstart;
+    unsigned int seed;
+    long i, lo, hi;
+    int thread, victim, tile, misses;
+
+    thread = omp_get_thread_num();
+
+#pragma omp single
+    {
+      nthread = omp_get_num_threads();
+    }
+
+    q = &deques[thread];
+    s = &stats[thread];
+
+    memset(s, 0, sizeof(stealstats));
+
+    /* Push this thread's block so that it is popped in increasing order */
+
+    lo = first + ((long) (last-first)*thread)/nthread;
+    hi = first + ((long) (last-first)*(thread+1))/nthread;
+
+    q->capacity = (hi > lo) ? hi-lo : 1;
+    q->tiles = (_Atomic int *) malloc(q->capacity*sizeof(_Atomic int));
+
+    if (NULL == q->tiles)
+    {
+      fprintf(stderr, "stealrun: cannot allocate deque of %ld tiles\n", q->capacity);
+      exit(-1);
+    }
+
+    atomic_init(&q->top, 0);
+    atomic_init(&q->bottom, 0);
+
+    for (i=hi-1; i >= lo; i--)
+    {
+      stealpush(q, (int) i);
+    }
+
+    seed = 2654435761u*(thread+1);
+    misses = 0;
+
+#pragma omp barrier
+
+    while (atomic_load_explicit(&remaining, memory_order_acquire) > 0)
+    {
+      tile = stealpop(q);
+
+      if (tile == NOTILE && nthread > 1)
+      {
+        victim = stealrandom(&seed) % (nthread-1);
+        if (victim >= thread) victim++;
+
+        s->attempts++;
+
+        tile = stealtake(&deques[victim]);
+
+        if (tile >= 0) s->steals++;
+      }
+
+      /*
+       *  After failing to steal from as many victims as there are other
+       *  threads, give up the core in case a busy thread is waiting for it
+       */
+
+      if (tile < 0 && ++misses >= nthread-1)
+      {
+        sched_yield();
+        misses = 0;
+      }
+
+      if (tile >= 0)
+      {
+        tstart = omp_get_wtime();
+        task(arg, tile, thread);
+        s->busy += omp_get_wtime() - tstart;
+
+        misses = 0;
+
+        s->tiles++;
+
+        atomic_fetch_sub_explicit(&remaining, 1, memory_order_release);
+      }
+    }
+
+    /* No thief can still be reading the deque once all the tiles are done */
+
+#pragma omp barrier
+
+    free(q->tiles);
+  }
+
+  free(deques);
+
+  return nthread;
+}
+
+/*
+ *  The number of tiles of ti x tj pixels covering an nx x ny image, and
+ *  the pixels [*i0, *i1) x [*j0, *j1) of tile t. Tiles are numbered
+ *  along j first, so consecutive tiles are close in memory.
+ */
+
+int stealtilecount(int nx, int ny, int ti, int tj)
+{
+  return ((nx+ti-1)/ti)*((ny+tj-1)/tj);
+}
+
+void stealtilebounds(int t, int nx, int ny, int ti, int tj,
+                     int *i0, int *i1, int *j0, int *j1)
+{
+  int ntj = (ny+tj-1)/tj;
+
+  *i0 = (t/ntj)*ti;
+  *j0 = (t%ntj)*tj;
+
+  *i1 = (*i0+ti > nx) ? nx : *i0+ti;
+  *j1 = (*j0+tj > ny) ? ny : *j0+tj;
+}
+
+/*
+ *  Print what each thread did, and the load imbalance as the largest
+ *  busy time divided by the average.
+ */
+
+void stealreport(stealstats *stats, int nthread)
+{
+  double tmax, tmean;
+  long steals, attempts;
+  int t;
+
+  tmax = tmean = 0.0;
+  steals = attempts = 0;
+
+  printf("Work stealing:  thread   tiles  steals  attempts   busy time\n");
+
+  for (t=0; t < nthread; t++)
+  {
+    printf("               %7d %7ld %7ld %9ld %11.6f\n", t,
+           stats[t].tiles, stats[t].steals, stats[t].attempts, stats[t].busy);
+
+    if (stats[t].busy > tmax) tmax = stats[t].busy;
+    tmean += stats[t].busy/nthread;
+
+    steals   += stats[t].steals;
+    attempts += stats[t].attempts;
+  }
+
+  printf("Stole %ld tiles in %ld attempts\n", steals, attempts);
+  printf("Load imbalance (max/mean busy time) was %f\n", tmean > 0.0 ? tmax/tmean : 1.0);
+  printf("\n");
+}
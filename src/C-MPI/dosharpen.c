@@ -11,6 +11,9 @@
  *  convolution result to the fuzzy image and writes the resulting sharp image to 
  *  file.
  *
+ *  Setting SHARPEN_DECOMP=block instead divides the image into blocks over
+ *  a 2-D grid of processes, with halos swapped between neighbours (see decomp.c).
+ *
  *  David Henty, EPCC, September 2009
  *  Arno Proeme, EPCC, March 2013 (minor modifications)
  *  Dominic Sloan-Murphy, EPCC, November 2013 (more minor modifications)
@@ -33,24 +36,62 @@ void dosharpen(char *infile, int nx, int ny, MPI_Comm comm)
   double  norm = (2*d-1)*(2*d-1);  
   double scale = 2.0;
   
-  int rank, size;
+  int rank, size, decomp;
   int xpix, ypix, pixcount;
 
   int i, j, k, l;
+  double *w;
   double tstart, tstop, time;
 
   char *outfile = "sharpened.pgm";
 
-  int **fuzzy = int2Dmalloc(nx, ny);                   /* Will store the fuzzy input image when it is first read in from file */
-  double **fuzzyPadded = double2Dmalloc(nx+2*d, ny+2*d);  /* Will store the fuzzy input image plus additional border padding */
-  double **convolutionPartial = double2Dmalloc(nx, ny);   /* Will store the convolution of the filter with parts of the fuzzy image computed by individual processes */
-  double **convolution = double2Dmalloc(nx, ny);          /* Will store the convolution of the filter with the full fuzzy image */
-  double **sharp = double2Dmalloc(nx, ny);                /* Will store the sharpened image obtained by adding rescaled convolution to the fuzzy image */
-  double **sharpCropped = double2Dmalloc(nx-2*d, ny-2*d); /* Will store the sharpened image cropped to remove a border layer distorted by the algorithm */
-  
+  int **fuzzy;                 /* Will store the fuzzy input image when it is first read in from file */
+  double **fuzzyPadded;        /* Will store the fuzzy input image plus additional border padding */
+  double **convolutionPartial; /* Will store the convolution of the filter with parts of the fuzzy image computed by individual processes */
+  double **convolution;        /* Will store the convolution of the filter with the full fuzzy image */
+  double **sharp;              /* Will store the sharpened image obtained by adding rescaled convolution to the fuzzy image */
+  double **sharpCropped;       /* Will store the sharpened image cropped to remove a border layer distorted by the algorithm */
+
   MPI_Comm_size(comm, &size);
   MPI_Comm_rank(comm, &rank);
 
+  if (2*d >= nx || 2*d >= ny)
+    {
+      if (rank == 0) printf("Error: a %d x %d image is too small for a filter of range %d\n", nx, ny, d);
+      fflush(stdout);
+
+      MPI_Finalize();
+      exit(-1);
+    }
+
+  /* Check SHARPEN_DECOMP and SHARPEN_GRID whichever way the input is read */
+
+  decomp = decompmode();
+
+  /* Binary input files are read and written in parallel with MPI-IO */
+
+  if (sharpenmpiio(infile, outfile, nx, ny, d, scale/norm, comm))
+    {
+      freefilterbanks();
+      return;
+    }
+
+  /* Otherwise each process can hold just its own block of the image */
+
+  if (decomp == DECOMP_BLOCK)
+    {
+      sharpendecomp(infile, outfile, nx, ny, d, scale/norm, comm);
+      freefilterbanks();
+      return;
+    }
+
+  fuzzy = int2Dmalloc(nx, ny);
+  fuzzyPadded = double2Dmalloc(nx+2*d, ny+2*d);
+  convolutionPartial = double2Dmalloc(nx, ny);
+  convolution = double2Dmalloc(nx, ny);
+  sharp = double2Dmalloc(nx, ny);
+  sharpCropped = double2Dmalloc(nx-2*d, ny-2*d);
+
   /* Initialise image arrays */
   for (i=0; i < nx; i++)
     {
@@ -117,6 +158,9 @@ void dosharpen(char *infile, int nx, int ny, MPI_Comm comm)
     
   tstart = MPI_Wtime();
 
+  /* Use the precomputed coefficients rather than calling filter() for every tap */
+  w = getfilter(d)->w;
+
   pixcount = 0;
 
   for (i=0; i < nx; i++)
@@ -131,7 +175,7 @@ void dosharpen(char *infile, int nx, int ny, MPI_Comm comm)
                 {
                   for (l= -d; l <= d; l++)
                     {
-                      convolutionPartial[i][j] = convolutionPartial[i][j] + filter(d,k,l)*fuzzyPadded[i+d+k][j+d+l];
+                      convolutionPartial[i][j] = convolutionPartial[i][j] + w[(k+d)*(2*d+1)+(l+d)]*fuzzyPadded[i+d+k][j+d+l];
                     }
                 }
             }
@@ -192,6 +236,8 @@ void dosharpen(char *infile, int nx, int ny, MPI_Comm comm)
   free(convolution);
   free(sharp);
   free(sharpCropped);
+
+  freefilterbanks();
 }
 
 
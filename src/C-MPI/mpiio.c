@@ -0,0 +1,375 @@
+/*  Parallel input and output of binary (P5) images using MPI-IO.
+ *
+ *  In the replicated-data version the master process reads the whole
+ *  image, broadcasts it and finally writes the whole result, so its
+ *  memory and I/O time grow with the size of the image however many
+ *  processes there are. The pixels of a P5 file are stored at fixed
+ *  offsets, so instead each process can read and write its own part of
+ *  the file directly.
+ *
+ *  The cropped output image is divided into bands of consecutive rows,
+ *  one per process. To compute its band a process needs the same rows
+ *  of the input plus d more on either side, which always lie inside the
+ *  image, so there is no padding. Only the header is handled by the
+ *  master process, which parses it and broadcasts the image size and
+ *  the offset of the first pixel. Each process then describes its rows
+ *  with a subarray datatype and reads them with a collective
+ *  MPI_File_read_at_all.
+ *
+ *  The output is scaled using the largest and smallest values over the
+ *  whole image, found with MPI_Allreduce. For P5 output the master
+ *  process writes the header and each process then writes its band
+ *  with MPI_File_write_at_all; for P2 output, whose pixels are of
+ *  varying length, the bands are gathered and written by the master.
+ *
+ *  The arrays here are held in file order, as y[ny][nx] with the top
+ *  row first, rather than as x[i][j] with j flipped as in dosharpen.c.
+ *  The terms of the convolution are added up in the same order, so the
+ *  results are identical.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <mpi.h>
+#include "sharpen.h"
+
+/*
+ *  Rows [*y0, *y1) of the n rows of output computed by this process
+ */
+
+static void mpiioband(int n, int rank, int size, int *y0, int *y1)
+{
+  *y0 = (int) (((long) n*rank)/size);
+  *y1 = (int) (((long) n*(rank+1))/size);
+}
+
+/*
+ *  A datatype describing rows [y0, y0+nrow) of an image of ny rows of
+ *  rowbytes bytes each, or MPI_BYTE for a process with no rows, which
+ *  must then transfer nothing.
+ */
+
+static MPI_Datatype mpiiorows(int ny, int rowbytes, int y0, int nrow)
+{
+  MPI_Datatype rows;
+  int sizes[2], subsizes[2], starts[2];
+
+  if (nrow == 0) return MPI_BYTE;
+
+  sizes[0] = ny;
+  sizes[1] = rowbytes;
+
+  subsizes[0] = nrow;
+  subsizes[1] = rowbytes;
+
+  starts[0] = y0;
+  starts[1] = 0;
+
+  MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_BYTE, &rows);
+  MPI_Type_commit(&rows);
+
+  return rows;
+}
+
+static void mpiiofree(MPI_Datatype *rows)
+{
+  if (*rows != MPI_BYTE) MPI_Type_free(rows);
+}
+
+/*
+ *  Sharpen the nx x ny image in infile and write the cropped result to
+ *  outfile, as dosharpen does, with sharp = fuzzy - factor*convolution.
+ *  Returns 0, having done nothing, if infile is not a P5 file, in which
+ *  case the caller should use the replicated-data version.
+ */
+
+int sharpenmpiio(char *infile, char *outfile, int nx, int ny, int d,
+                 double factor, MPI_Comm comm)
+{
+  pgmfile *pf;
+  MPI_File fh;
+  MPI_Datatype rows;
+  MPI_Status status;
+  MPI_Offset offset;
+
+  int header[4], rank, size, nxt, nyt, maxval, binary, bpp, count, t;
+  int nxs, nys, nw, y0, y1, nrow, *recvcounts, *displs;
+  int x, y, k, l, r;
+  long off;
+
+  unsigned char *bytes, *grey;
+  double *fuzzy, *sharp, *sharpAll, *w;
+  double conv, xmin, xmax, thresh, tstart, tstop, time;
+
+  MPI_Comm_size(comm, &size);
+  MPI_Comm_rank(comm, &rank);
+
+  /* The master parses the header and broadcasts what it found */
+
+  if (rank == 0)
+    {
+      pf = pgmopen(infile, &nxt, &nyt, &maxval);
+      off = pgmoffset(pf, &binary);
+      pgmclose(pf);
+
+      header[0] = nxt;
+      header[1] = nyt;
+      header[2] = maxval;
+      header[3] = binary;
+      offset = off;
+    }
+
+  MPI_Bcast(header, 4, MPI_INT, 0, comm);
+  MPI_Bcast(&offset, 1, MPI_OFFSET, 0, comm);
+
+  nxt    = header[0];
+  nyt    = header[1];
+  maxval = header[2];
+  binary = header[3];
+
+  if (!binary) return 0;
+
+  /* P5 files are always divided into bands of rows, so a block
+     decomposition would silently be ignored */
+
+  if (decompmode() == DECOMP_BLOCK)
+    {
+      if (rank == 0) printf("Error: SHARPEN_DECOMP=block cannot be used with binary (P5) input\n");
+      fflush(stdout);
+
+      MPI_Finalize();
+      exit(-1);
+    }
+
+  if (nx != nxt || ny != nyt)
+    {
+      if (rank == 0) printf("Error reading %s\n", infile);
+      fflush(stdout);
+
+      MPI_Finalize();
+      exit(-1);
+    }
+
+  nw  = 2*d+1;
+  nxs = nx-2*d;
+  nys = ny-2*d;
+  bpp = (maxval > 255) ? 2 : 1;
+
+  /* The output has the same maximum grey level, and so bytes per pixel */
+
+  thresh = maxval;
+
+  mpiioband(nys, rank, size, &y0, &y1);
+  nrow = y1-y0;
+
+  bytes = (unsigned char *) malloc((long) (nrow+2*d)*nx*bpp);
+  fuzzy = (double *) malloc((long) (nrow+2*d)*nx*sizeof(double));
+  sharp = (double *) malloc(((long) nrow*nxs+1)*sizeof(double));
+  grey  = (unsigned char *) malloc((long) nrow*nxs*bpp+1);
+
+  if (NULL == bytes || NULL == fuzzy || NULL == sharp || NULL == grey)
+    {
+      fprintf(stderr, "sharpenmpiio: cannot allocate band of %d rows\n", nrow);
+      MPI_Abort(comm, -1);
+    }
+
+  if (rank == 0)
+    {
+      printf("Using a filter of size %d x %d\n", nw, nw);
+      printf("\n");
+
+      printf("Reading image file with MPI-IO: %s\n", infile);
+      fflush(stdout);
+    }
+
+  /* Input rows [y0, y1+2d) hold the filter for output rows [y0, y1) */
+
+  count = (nrow+2*d)*nx*bpp;
+  rows  = mpiiorows(ny, nx*bpp, y0, nrow+2*d);
+
+  MPI_File_open(comm, infile, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh);
+  MPI_File_set_view(fh, offset, MPI_BYTE, rows, "native", MPI_INFO_NULL);
+  MPI_File_read_at_all(fh, 0, bytes, count, MPI_BYTE, &status);
+  MPI_File_close(&fh);
+
+  mpiiofree(&rows);
+
+  MPI_Get_count(&status, MPI_BYTE, &k);
+
+  if (k != count)
+    {
+      fprintf(stderr, "sharpenmpiio: <%s> is too short\n", infile);
+      MPI_Abort(comm, -1);
+    }
+
+  for (k=0; k < (nrow+2*d)*nx; k++)
+    {
+      fuzzy[k] = (bpp == 1) ? bytes[k] : 256*bytes[2*k] + bytes[2*k+1];
+    }
+
+  free(bytes);
+
+  if (rank == 0)
+    {
+      printf("... done\n\n");
+      printf("Starting calculation ...\n");
+      fflush(stdout);
+    }
+
+  MPI_Barrier(comm);
+
+  tstart = MPI_Wtime();
+
+  w = getfilter(d)->w;
+
+  /*
+   *  Output pixel (x, y) is image pixel (x+d, y+d), i.e. row y+d-y0 of
+   *  the band. Row y-l of the file is column j+l of x[i][j].
+   */
+
+  for (y=y0; y < y1; y++)
+    {
+      for (x=0; x < nxs; x++)
+        {
+          conv = 0.0;
+
+          for (k=-d; k <= d; k++)
+            {
+              for (l=-d; l <= d; l++)
+                {
+                  conv = conv + w[(k+d)*nw+(l+d)]*fuzzy[(long) (y+d-y0-l)*nx+(x+d+k)];
+                }
+            }
+
+          sharp[(long) (y-y0)*nxs+x] = fuzzy[(long) (y+d-y0)*nx+(x+d)] - factor*conv;
+        }
+    }
+
+  MPI_Barrier(comm);
+
+  tstop = MPI_Wtime();
+  time = tstop - tstart;
+
+  /* Scale by the max and min absolute values over the whole image */
+
+  xmin = HUGE_VAL;
+  xmax = 0.0;
+
+  for (k=0; k < nrow*nxs; k++)
+    {
+      if (fabs(sharp[k]) < xmin) xmin = fabs(sharp[k]);
+      if (fabs(sharp[k]) > xmax) xmax = fabs(sharp[k]);
+    }
+
+  MPI_Allreduce(MPI_IN_PLACE, &xmin, 1, MPI_DOUBLE, MPI_MIN, comm);
+  MPI_Allreduce(MPI_IN_PLACE, &xmax, 1, MPI_DOUBLE, MPI_MAX, comm);
+
+  if (rank == 0)
+    {
+      printf("... finished\n");
+      printf("\n");
+
+      printf("Writing output file: %s\n", outfile);
+      printf("\n");
+      fflush(stdout);
+
+      binary = pgmbinaryformat();
+
+      if (binary)
+        {
+          pf = pgmcreate(outfile, nxs, nys, (int) thresh);
+          off = pgmoffset(pf, &binary);
+          pgmclose(pf);
+
+          offset = off;
+        }
+    }
+
+  MPI_Bcast(&binary, 1, MPI_INT, 0, comm);
+
+  if (binary)
+    {
+      /* The header is in place, so every process writes its own rows */
+
+      MPI_Bcast(&offset, 1, MPI_OFFSET, 0, comm);
+
+      for (k=0; k < nrow*nxs; k++)
+        {
+          t = pgmgrey(sharp[k], xmin, xmax, thresh);
+
+          if (bpp == 1)
+            {
+              grey[k] = t;
+            }
+          else
+            {
+              grey[2*k]   = t >> 8;
+              grey[2*k+1] = t & 0xff;
+            }
+        }
+
+      rows = mpiiorows(nys, nxs*bpp, y0, nrow);
+
+      MPI_File_open(comm, outfile, MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+      MPI_File_set_view(fh, offset, MPI_BYTE, rows, "native", MPI_INFO_NULL);
+      MPI_File_write_at_all(fh, 0, grey, nrow*nxs*bpp, MPI_BYTE, &status);
+      MPI_File_close(&fh);
+
+      mpiiofree(&rows);
+    }
+  else
+    {
+      /* ASCII output cannot be written in parallel, so gather it */
+
+      recvcounts = NULL;
+      displs = NULL;
+      sharpAll = NULL;
+
+      if (rank == 0)
+        {
+          recvcounts = (int *) malloc(size*sizeof(int));
+          displs = (int *) malloc(size*sizeof(int));
+          sharpAll = (double *) malloc((long) nxs*nys*sizeof(double));
+
+          if (NULL == recvcounts || NULL == displs || NULL == sharpAll)
+            {
+              fprintf(stderr, "sharpenmpiio: cannot allocate output image\n");
+              MPI_Abort(comm, -1);
+            }
+
+          for (r=0; r < size; r++)
+            {
+              mpiioband(nys, r, size, &y0, &y1);
+              recvcounts[r] = (y1-y0)*nxs;
+              displs[r] = y0*nxs;
+            }
+        }
+
+      MPI_Gatherv(sharp, nrow*nxs, MPI_DOUBLE, sharpAll, recvcounts, displs,
+                  MPI_DOUBLE, 0, comm);
+
+      if (rank == 0)
+        {
+          pgmwriterows(outfile, sharpAll, nxs, nys);
+
+          free(recvcounts);
+          free(displs);
+          free(sharpAll);
+        }
+    }
+
+  if (rank == 0)
+    {
+      printf("... done\n");
+      printf("\n");
+      printf("Calculation time was %f seconds\n", time);
+      fflush(stdout);
+    }
+
+  free(fuzzy);
+  free(sharp);
+  free(grey);
+
+  return 1;
+}
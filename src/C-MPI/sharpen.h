@@ -1,9 +1,49 @@
+#include <mpi.h>
+
 void pgmsize(char *filename, int *nx, int *ny);
 void pgmread(char *filename, void *vp, int nxmax, int nymax, int *nx, int *ny);
 void pgmwrite(char *filename, void *vx, int nx, int ny);
+void pgmwriterows(char *filename, void *vx, int nx, int ny);
+int pgmgrey(double tmp, double xmin, double xmax, double thresh);
+
+typedef struct pgmfile pgmfile;
+pgmfile *pgmopen(char *filename, int *nx, int *ny, int *maxval);
+pgmfile *pgmcreate(char *filename, int nx, int ny, int maxval);
+long pgmoffset(pgmfile *pf, int *binary);
+int pgmbinaryformat(void);
+void pgmclose(pgmfile *pf);
 
 void dosharpen(char *filename, int nx, int ny, MPI_Comm comm);
+int sharpenmpiio(char *infile, char *outfile, int nx, int ny, int d,
+                 double factor, MPI_Comm comm);
+
+/* Block decomposition with halo exchange, see decomp.c */
+
+#define DECOMP_REPLICATED 0
+#define DECOMP_BLOCK      1
+
+int decompmode(void);
+void sharpendecomp(char *infile, char *outfile, int nx, int ny, int d,
+                   double factor, MPI_Comm comm);
 double filter(int d, int i, int j);
 
+/* Precomputed filter coefficients, see filterbank.c */
+
+typedef struct
+{
+  int d;
+  double sigma, filter0;
+  double *w;
+  float *wf;
+} filterbank;
+
+double filtersigma(int d);
+double filterpeak(void);
+double filterfunc(double sigma, double filter0, int i, int j);
+
+filterbank *getfilterbank(int d, double sigma, double filter0);
+filterbank *getfilter(int d);
+void freefilterbanks(void);
+
 int **int2Dmalloc(int nx, int ny);
 double **double2Dmalloc(int nx, int ny);
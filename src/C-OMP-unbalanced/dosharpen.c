@@ -29,6 +29,13 @@ void dosharpen(char *infile, int nx, int ny)
      only pixels within a (2d+1)*(2d+1) square centered on the pixel are used to 
      compute its new value. */
 
+  if (2*d >= nx || 2*d >= ny)
+    {
+      printf("Error: a %d x %d image is too small for a filter of range %d\n", nx, ny, d);
+      fflush(stdout);
+      exit(-1);
+    }
+
   double  norm = (2*d-1)*(2*d-1);
   double scale = 2.0;
   
@@ -36,7 +43,16 @@ void dosharpen(char *infile, int nx, int ny)
   int xpix, ypix, pixcount;
   
   int i, j, k, l, dtmp;
+  long p;
+  double *w;
+  filterbank *fb[d+1];
   double tstart, tstop, time;
+
+  int partition = partitionmode();
+  long first[omp_get_max_threads()+1];  /* Pixels first[t] <= p < first[t+1] are computed by thread t with SHARPEN_PARTITION=cost */
+  long cost[omp_get_max_threads()];     /* Number of filter taps in each of those chunks                                           */
+  double busy[omp_get_max_threads()];   /* Time each thread spends computing its pixels                                             */
+  stealstats stats[omp_get_max_threads()]; /* Tiles computed and stolen by each thread with SHARPEN_PARTITION=steal                  */
   
   int fuzzy[nx][ny];                   /* Will store the fuzzy input image when it is first read in from file                        */
   double fuzzyPadded[nx+2*d][ny+2*d];  /* Will store the fuzzy input image plus additional border padding                            */
@@ -58,6 +74,7 @@ void dosharpen(char *infile, int nx, int ny)
     }
   
   printf("Using a filter of size %d x %d\n", 2*d+1, 2*d+1);
+  printf("Using %s partitioning of the pixels\n", partitionname(partition));
   printf("\n");
 
   printf("Reading image file: %s\n", infile);
@@ -102,43 +119,103 @@ void dosharpen(char *infile, int nx, int ny)
 
   tstart = omp_get_wtime();
 
+  /* Precompute the coefficients for every filter range used below
+     rather than calling filter() for every tap */
+  for (dtmp=2; dtmp <= d; dtmp++)
+    {
+      fb[dtmp] = getfilter(dtmp);
+    }
+
+  if (partition == PARTITION_STEAL)
+    {
+      /* Threads which run out of tiles steal them from those still busy */
+      nthreads = stealpartition(&convolution[0][0], &fuzzyPadded[0][0], fb, nx, ny, d, stats);
+    }
+  else
+    {
   /* Start of parallel region where filter is applied to fuzzy image */
-#pragma omp parallel private(i, j, k, l, dtmp, pixcount, threadid)
+#pragma omp parallel private(i, j, k, l, p, dtmp, w, pixcount, threadid)
 {
   nthreads  = omp_get_num_threads();
   threadid = omp_get_thread_num();
-  
-  pixcount = 0;
-  
-  for (i=0; i < nx; i++)
+
+  if (partition == PARTITION_COST)
     {
-      for (j=0; j < ny; j++)
+      /* Cut the pixels into contiguous chunks of equal cost, one per thread */
+#pragma omp single
+      {
+        costpartition(first, cost, nthreads, nx, ny, d);
+      }
+    }
+
+  busy[threadid] = omp_get_wtime();
+
+  if (partition == PARTITION_COST)
+    {
+      for (p=first[threadid]; p < first[threadid+1]; p++)
         {
-          dtmp = 2 + ((d-1)*(i+j))/(nx+ny);
+          i = p/ny;
+          j = p%ny;
+
+          dtmp = pixelrange(i, j, nx, ny, d);
+          w = fb[dtmp]->w;
 
-          /* Computation of convolution allocated to threads using simple cyclic distribution
-             i.e. consecutively numbered threads take turns computing convolution for consecutive pixels */
-          if (pixcount%nthreads  == threadid)
+          for (k=-dtmp; k <= dtmp; k++)
+            {
+              for (l= -dtmp; l <= dtmp; l++)
+                {
+                  convolution[i][j] = convolution[i][j] + w[(k+dtmp)*(2*dtmp+1)+(l+dtmp)]*fuzzyPadded[i+dtmp+k][j+dtmp+l];
+                }
+            }
+        }
+    }
+  else
+    {
+      pixcount = 0;
+  
+      for (i=0; i < nx; i++)
+        {
+          for (j=0; j < ny; j++)
             {
-              for (k=-dtmp; k <= dtmp; k++)
+              dtmp = 2 + ((d-1)*(i+j))/(nx+ny);
+              w = fb[dtmp]->w;
+
+              /* Computation of convolution allocated to threads using simple cyclic distribution
+                 i.e. consecutively numbered threads take turns computing convolution for consecutive pixels */
+              if (pixcount%nthreads  == threadid)
                 {
-                  for (l= -dtmp; l <= dtmp; l++)
+                  for (k=-dtmp; k <= dtmp; k++)
                     {
-                      convolution[i][j] = convolution[i][j] + filter(dtmp,k,l)*fuzzyPadded[i+dtmp+k][j+dtmp+l];
+                      for (l= -dtmp; l <= dtmp; l++)
+                        {
+                          convolution[i][j] = convolution[i][j] + w[(k+dtmp)*(2*dtmp+1)+(l+dtmp)]*fuzzyPadded[i+dtmp+k][j+dtmp+l];
+                        }
                     }
                 }
+              pixcount += 1;
             }
-          pixcount += 1;
         }
     }
+
+  busy[threadid] = omp_get_wtime() - busy[threadid];
 }
   /* End of parallel region and convolution computation */
+    }
   
   tstop = omp_get_wtime();
   time = tstop - tstart;
   
   printf("... finished\n");
   printf("\n");
+
+  if (partition == PARTITION_STEAL)
+    {
+      stealreport(stats, nthreads);
+    }
+  else
+    {
+      printimbalance(busy, partition == PARTITION_COST ? cost : NULL, nthreads);
+    }
   fflush(stdout);
   
   /* Add rescaled convolution to fuzzy image to obtain sharp image */
@@ -168,4 +245,6 @@ void dosharpen(char *infile, int nx, int ny)
   printf("\n");
   printf("Calculation time was %f seconds\n", time);
   fflush(stdout);
+
+  freefilterbanks();
 }
@@ -0,0 +1,241 @@
+/*  Static partitioning of the spatially varying filter by cost.
+ *
+ *  In this version the range of the filter grows from 2 to d across the
+ *  image, so the cost of a pixel, the number of taps (2*dtmp+1)^2, is
+ *  more than ten times larger at one corner than at the other. The
+ *  cyclic distribution only balances this because consecutive pixels
+ *  cost almost the same; a plain block distribution would give the
+ *  last thread far more work than the first.
+ *
+ *  Here the pixels are taken in the order of the loop in dosharpen,
+ *  i.e. i*ny+j, and the running sum of their costs is cut into nthread
+ *  contiguous chunks of equal cost. Each thread then works through a
+ *  single block of memory with no loop overhead for other threads'
+ *  pixels, and no dynamic scheduling is needed.
+ *
+ *  Alternatively the pixels can be cut into tiles and handed out by the
+ *  work-stealing scheduler in steal.c, which needs no cost model at all:
+ *  each thread starts with an equal number of tiles and those that
+ *  finish early take tiles from those that are still busy.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sharpen.h"
+
+static char *partitionnames[] = {"cyclic", "cost", "steal"};
+
+#define NPARTITION (int) (sizeof(partitionnames)/sizeof(partitionnames[0]))
+
+/* Size of the tiles used with SHARPEN_PARTITION=steal */
+
+#define STEALTILEI 16
+#define STEALTILEJ 64
+
+/*
+ *  The partitioning chosen with SHARPEN_PARTITION, cyclic by default
+ */
+
+int partitionmode(void)
+{
+  char *value = getenv("SHARPEN_PARTITION");
+  int i;
+
+  if (NULL == value || 0 == strlen(value)) return PARTITION_CYCLIC;
+
+  for (i=0; i < NPARTITION; i++)
+  {
+    if (0 == strcmp(value, partitionnames[i])) return i;
+  }
+
+  fprintf(stderr, "partitionmode: unknown value SHARPEN_PARTITION=%s, valid values are:", value);
+  for (i=0; i < NPARTITION; i++) fprintf(stderr, " %s", partitionnames[i]);
+  fprintf(stderr, "\n");
+
+  exit(-1);
+}
+
+char *partitionname(int partition)
+{
+  if (partition < 0 || partition >= NPARTITION) return "unknown";
+
+  return partitionnames[partition];
+}
+
+/*
+ *  Range of the filter at pixel (i,j), and the number of taps it costs
+ */
+
+int pixelrange(int i, int j, int nx, int ny, int d)
+{
+  return 2 + ((d-1)*(i+j))/(nx+ny);
+}
+
+long pixelcost(int i, int j, int nx, int ny, int d)
+{
+  long nw = 2*pixelrange(i, j, nx, ny, d)+1;
+
+  return nw*nw;
+}
+
+/*
+ *  Cut the nx*ny pixels into nthread chunks of equal cost. Thread t
+ *  computes pixels first[t] <= p < first[t+1], and the cost of its
+ *  chunk is returned in cost[t]. Chunk t ends at the first pixel at
+ *  which the prefix sum of the costs reaches (t+1)/nthread of the total.
+ */
+
+void costpartition(long *first, long *cost, int nthread, int nx, int ny, int d)
+{
+  long total, sum, target, p;
+  int i, j, t;
+
+  total = 0;
+
+  for (i=0; i < nx; i++)
+  {
+    for (j=0; j < ny; j++)
+    {
+      total += pixelcost(i, j, nx, ny, d);
+    }
+  }
+
+  first[0] = 0;
+  cost[0] = 0;
+
+  sum = 0;
+  t = 0;
+  target = total/nthread;
+
+  for (p=0; p < (long) nx*ny; p++)
+  {
+    i = p/ny;
+    j = p%ny;
+
+    sum += pixelcost(i, j, nx, ny, d);
+    cost[t] += pixelcost(i, j, nx, ny, d);
+
+    /* Several chunks may end at once if nthread is larger than nx*ny */
+
+    while (t < nthread-1 && sum >= target)
+    {
+      t++;
+      first[t] = p+1;
+      cost[t] = 0;
+      target = (total*(t+1))/nthread;
+    }
+  }
+
+  for (t=t+1; t < nthread; t++)
+  {
+    first[t] = (long) nx*ny;
+    cost[t] = 0;
+  }
+
+  first[nthread] = (long) nx*ny;
+}
+
+/*
+ *  Convolution of one tile with the varying filter, adding up the taps
+ *  of each pixel in the same order as the loop in dosharpen
+ */
+
+typedef struct
+{
+  double *conv, *padded;
+  filterbank **fb;
+  int nx, ny, d;
+} partitiontiles;
+
+static void partitiontile(void *arg, int t, int thread)
+{
+  partitiontiles *pt = (partitiontiles *) arg;
+  int nyp = pt->ny + 2*pt->d;
+  int i, j, k, l, i0, i1, j0, j1, dtmp, nw;
+  double *w, sum;
+
+  stealtilebounds(t, pt->nx, pt->ny, STEALTILEI, STEALTILEJ, &i0, &i1, &j0, &j1);
+
+  for (i=i0; i < i1; i++)
+    {
+      for (j=j0; j < j1; j++)
+        {
+          dtmp = pixelrange(i, j, pt->nx, pt->ny, pt->d);
+          w = pt->fb[dtmp]->w;
+          nw = 2*dtmp+1;
+
+          sum = pt->conv[(long) i*pt->ny+j];
+
+          for (k=-dtmp; k <= dtmp; k++)
+            {
+              for (l=-dtmp; l <= dtmp; l++)
+                {
+                  sum = sum + w[(k+dtmp)*nw+(l+dtmp)]*pt->padded[(long) (i+dtmp+k)*nyp + (j+dtmp+l)];
+                }
+            }
+
+          pt->conv[(long) i*pt->ny+j] = sum;
+        }
+    }
+}
+
+/*
+ *  Compute the convolution in tiles shared out by work stealing. What
+ *  each thread did is returned in stats, and the number of threads used
+ *  is returned.
+ */
+
+int stealpartition(double *conv, double *padded, filterbank **fb,
+                   int nx, int ny, int d, stealstats *stats)
+{
+  partitiontiles pt;
+
+  pt.conv = conv;
+  pt.padded = padded;
+  pt.fb = fb;
+  pt.nx = nx;
+  pt.ny = ny;
+  pt.d  = d;
+
+  return stealrun(0, stealtilecount(nx, ny, STEALTILEI, STEALTILEJ), partitiontile, &pt, stats);
+}
+
+/*
+ *  Report how evenly the work was spread, as the largest time taken by
+ *  any thread divided by the average: 1 is perfect balance, and the
+ *  parallel loop takes as long as the slowest thread. If cost is not
+ *  NULL the same ratio is reported for the number of taps per thread
+ *  predicted by the cost model.
+ */
+
+void printimbalance(double *busy, long *cost, int nthread)
+{
+  double tmax, tmean, cmax, cmean;
+  int t;
+
+  tmax = tmean = 0.0;
+  cmax = cmean = 0.0;
+
+  for (t=0; t < nthread; t++)
+  {
+    if (busy[t] > tmax) tmax = busy[t];
+    tmean += busy[t]/nthread;
+
+    if (NULL != cost)
+    {
+      if (cost[t] > cmax) cmax = cost[t];
+      cmean += (double) cost[t]/nthread;
+    }
+  }
+
+  printf("Thread busy time: max %f, mean %f seconds\n", tmax, tmean);
+  printf("Load imbalance (max/mean) was %f\n", tmean > 0.0 ? tmax/tmean : 1.0);
+
+  if (NULL != cost)
+  {
+    printf("Cost model imbalance (max/mean taps) was %f\n", cmean > 0.0 ? cmax/cmean : 1.0);
+  }
+
+  printf("\n");
+}
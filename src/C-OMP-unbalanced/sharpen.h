@@ -4,3 +4,54 @@ void pgmwrite(char *filename, void *vx, int nx, int ny);
 
 void dosharpen(char *filename, int nx, int ny);
 double filter(int d, int i, int j);
+
+/* Precomputed filter coefficients, see filterbank.c */
+
+typedef struct
+{
+  int d;
+  double sigma, filter0;
+  double *w;
+  float *wf;
+} filterbank;
+
+double filtersigma(int d);
+double filterpeak(void);
+double filterfunc(double sigma, double filter0, int i, int j);
+
+filterbank *getfilterbank(int d, double sigma, double filter0);
+filterbank *getfilter(int d);
+void freefilterbanks(void);
+
+/* Work-stealing scheduler for tiles, see steal.c */
+
+typedef void (*stealtask)(void *arg, int tile, int thread);
+
+typedef struct
+{
+  long tiles;
+  long steals;
+  long attempts;
+  double busy;
+} stealstats;
+
+int stealrun(int first, int last, stealtask task, void *arg, stealstats *stats);
+void stealreport(stealstats *stats, int nthread);
+int stealtilecount(int nx, int ny, int ti, int tj);
+void stealtilebounds(int t, int nx, int ny, int ti, int tj, int *i0, int *i1, int *j0, int *j1);
+
+/* Partitioning of the pixels among the threads, see partition.c */
+
+#define PARTITION_CYCLIC 0
+#define PARTITION_COST   1
+#define PARTITION_STEAL  2
+
+int partitionmode(void);
+char *partitionname(int partition);
+int pixelrange(int i, int j, int nx, int ny, int d);
+long pixelcost(int i, int j, int nx, int ny, int d);
+void costpartition(long *first, long *cost, int nthread, int nx, int ny, int d);
+void printimbalance(double *busy, long *cost, int nthread);
+int stealpartition(double *conv, double *padded, filterbank **fb,
+                   int nx, int ny, int d, stealstats *stats);
+
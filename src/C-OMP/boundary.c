@@ -0,0 +1,68 @@
+/*  Treatment of pixels beyond the edges of the image.
+ *
+ *  The filter around a pixel within d of an edge extends outside the
+ *  image. By default those pixels are zero, but they can instead be
+ *  taken from the nearest edge pixel (clamp), from the image reflected
+ *  about its edge pixels (mirror) or from the opposite side of the
+ *  image (wrap). None of this matters for the usual cropped output,
+ *  which only contains pixels whose filter lies inside the image.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "sharpen.h"
+
+/*
+ *  Return the pixel of an image with n pixels along this direction that
+ *  supplies the value at position i, or -1 if the value is zero. Only
+ *  needs to work for -n < i < 2n.
+ */
+
+int boundaryindex(int boundary, int i, int n)
+{
+  if (i >= 0 && i < n) return i;
+
+  switch (boundary)
+  {
+    case BOUNDARY_CLAMP:
+      return i < 0 ? 0 : n-1;
+
+    case BOUNDARY_MIRROR:
+      return i < 0 ? -i : 2*(n-1)-i;
+
+    case BOUNDARY_WRAP:
+      return i < 0 ? i+n : i-n;
+
+    default:
+      return -1;
+  }
+}
+
+/*
+ *  Fill the border of width d around the nx x ny image in the padded
+ *  (nx+2d) x (ny+2d) array. The zero border is left as it is.
+ */
+
+void padboundary(int boundary, double *padded, int nx, int ny, int d)
+{
+  int nyp = ny+2*d;
+  int i, j, bi, bj;
+
+  if (boundary == BOUNDARY_ZERO) return;
+
+  for (i=-d; i < nx+d; i++)
+  {
+    bi = boundaryindex(boundary, i, nx);
+
+    for (j=-d; j < ny+d; j++)
+    {
+      /* Interior rows only need their ends filled */
+
+      if (i >= 0 && i < nx && j == 0) j = ny;
+
+      bj = boundaryindex(boundary, j, ny);
+
+      padded[(long) (i+d)*nyp+(j+d)] = padded[(long) (bi+d)*nyp+(bj+d)];
+    }
+  }
+}
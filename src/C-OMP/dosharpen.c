@@ -22,48 +22,254 @@
 #include "utilities.h"
 #include "sharpen.h"
 
+/*
+ *  Allocate an nx x ny image of elements of the given size, which is
+ *  too large for the stack in all but the smallest cases
+ */
+
+static void *imagemalloc(int nx, int ny, size_t size)
+{
+  void *image = malloc((long) nx*ny*size);
+
+  if (NULL == image)
+    {
+      printf("Error: cannot allocate a %d x %d image array\n", nx, ny);
+      fflush(stdout);
+      exit(-1);
+    }
+
+  return image;
+}
+
 void dosharpen(char *infile, int nx, int ny)
 {
-  int d = 8;  
+  sharpenopts opts = getoptions();
+
+  int d = opts.range;
   /* Sets the linear range of the sharpen filter as measured from any given pixel:
      only pixels within a (2d+1)*(2d+1) square centered on the pixel are used to 
-     compute its new value. */
+     compute its new value. The default of 8 can be changed with SHARPEN_RANGE,
+     which must be less than half the width and height of the image. */
+
+  if (2*d >= nx || 2*d >= ny)
+    {
+      printf("Error: SHARPEN_RANGE=%d is too large for a %d x %d image, it can be at most %d\n",
+             d, nx, ny, ((nx < ny ? nx : ny)-1)/2);
+      fflush(stdout);
+      exit(-1);
+    }
+
+  int engine = selectengine(opts.engine, nx, ny, d);
 
   double  norm = (2*d-1)*(2*d-1);
   double scale = 2.0;
   
   int nthreads, threadid;
-  int xpix, ypix, pixcount;
+  int xpix, ypix, pixcount, swap, pixbytes;
   
   int i, j, k, l;
+  double *w;
+  void *fuzzyImage;
   double tstart, tstop, time;
+
+  if (opts.stream)
+    {
+      /* Never hold the whole image: stream it from infile to the output a band at a time */
+      int band = streamband(nx, ny, d, pgmmaxval(), opts.memory);
+
+      printf("Using a filter of size %d x %d\n", 2*d+1, 2*d+1);
+      printf("Streaming the image in bands of %d rows\n", band);
+      printf("\n");
+
+      printf("Starting calculation ...\n");
+      fflush(stdout);
+
+      tstart = omp_get_wtime();
+      sharpenstream(infile, "sharpened.pgm", nx, ny, d, scale/norm, band);
+      tstop = omp_get_wtime();
+
+      printf("... finished\n");
+      printf("\n");
+      printf("Calculation time was %f seconds\n", tstop - tstart);
+      fflush(stdout);
+
+      freefilterbanks();
+      return;
+    }
+
+  if (opts.input == INPUT_MMAP)
+    {
+      /* Sharpen straight from the mapped file without copying it into any array */
+      printf("Using a filter of size %d x %d\n", 2*d+1, 2*d+1);
+      printf("Sharpening the memory-mapped input file\n");
+      printf("\n");
+
+      printf("Starting calculation ...\n");
+      fflush(stdout);
+
+      tstart = omp_get_wtime();
+      sharpenmapped(infile, "sharpened.pgm", nx, ny, d, scale/norm, opts.output, opts.boundary);
+      tstop = omp_get_wtime();
+
+      printf("... finished\n");
+      printf("\n");
+      printf("Calculation time was %f seconds\n", tstop - tstart);
+      fflush(stdout);
+
+      freefilterbanks();
+      return;
+    }
   
-  int fuzzy[nx][ny];                   /* Will store the fuzzy input image when it is first read in from file                        */
-  double fuzzyPadded[nx+2*d][ny+2*d];  /* Will store the fuzzy input image plus additional border padding                            */
-  double convolution[nx][ny];          /* Will store the convolution of the filter with the fuzzy image                              */
-  double sharp[nx][ny];                /* Will store the sharpened image obtained by adding the  convolution to the fuzzy image      */
-  double sharpCropped[nx-2*d][ny-2*d]; /* Will store the sharpened image cropped to remove a border layer distorted by the algorithm */
+  /* SHARPEN_LAYOUT=rows holds the image in file order, y[ny][nx] with the
+     top row first, so that it is read and written sequentially and each row
+     of the image is contiguous in memory. As the filter is symmetric this
+     is just x[i][j] with the roles of nx and ny exchanged, so they are
+     swapped here and the calculation below is unchanged */
+  if (opts.layout == LAYOUT_ROWS)
+    {
+      swap = nx;
+      nx = ny;
+      ny = swap;
+    }
+
+  /* Allocated on the heap below, and only if this pipeline uses them */
+  int (*fuzzy)[ny] = NULL;                   /* Will store the fuzzy input image when it is first read in from file                        */
+  double (*fuzzyPadded)[ny+2*d] = NULL;      /* Will store the fuzzy input image plus additional border padding                            */
+  double (*convolution)[ny] = NULL;          /* Will store the convolution of the filter with the fuzzy image                              */
+  double (*sharp)[ny] = NULL;                /* Will store the sharpened image obtained by adding the  convolution to the fuzzy image      */
+  double (*sharpCropped)[ny-2*d] = NULL;     /* Will store the sharpened image cropped to remove a border layer distorted by the algorithm */
+  unsigned char *fuzzyBytes = NULL;          /* Will store the fuzzy input image as bytes when SHARPEN_STORAGE=uint8                       */
+  unsigned short *fuzzyShorts = NULL;        /* Will store the fuzzy input image as 16-bit integers when SHARPEN_STORAGE=uint16           */
   
   char *outfile = "sharpened.pgm";
   
-  /* Initialise image arrays */
-  for (i=0; i < nx; i++)
+  printf("Using a filter of size %d x %d\n", 2*d+1, 2*d+1);
+  printf("Using the %s convolution engine%s\n", enginename(engine),
+         opts.engine == ENGINE_AUTO ? " (chosen automatically)" : "");
+  if (engine == ENGINE_SIMD)
+    {
+      printf("Using the %s kernel\n", isaname(selectisa(opts.isa)));
+    }
+  if (engine == ENGINE_TILED)
+    {
+      selecttiles(&opts.tilei, &opts.tilej, d);
+      printf("Using tiles of %d x %d pixels\n", opts.tilei, opts.tilej);
+    }
+  if (opts.schedule != SCHEDULE_CYCLIC)
+    {
+      selectworktiles(&opts.tilei, &opts.tilej);
+      printf("Sharing out tiles of %d x %d pixels with a %s schedule\n",
+             opts.tilei, opts.tilej, schedulename(opts.schedule));
+    }
+  if (engine == ENGINE_FIXED)
+    {
+      printf("Using the %s kernel\n", fixedspecialised(d) ? "specialised" : "generic");
+    }
+  if (opts.fused)
+    {
+      printf("Using the fused sharpening pipeline\n");
+    }
+  if (opts.storage == STORAGE_AUTO)
+    {
+      /* Choose the narrowest storage that holds the input grey levels */
+      opts.storage = (pgmmaxval() > 255) ? STORAGE_UINT16 : STORAGE_UINT8;
+    }
+  if (opts.storage != STORAGE_DOUBLE)
+    {
+      printf("Storing the input image as %s\n", storagename(opts.storage));
+    }
+  if (opts.output == OUTPUT_FULL)
+    {
+      printf("Writing the full image with %s boundaries\n", boundaryname(opts.boundary));
+    }
+  if (opts.layout == LAYOUT_ROWS)
+    {
+      printf("Holding the image in file order\n");
+    }
+  if (opts.precision != PRECISION_DOUBLE)
+    {
+      printf("Using %s precision arithmetic\n", precisionname(opts.precision));
+    }
+  printf("\n");
+
+  /* Allocate only the arrays this pipeline uses: integer storage keeps the
+     input in fuzzyBytes or fuzzyShorts, the fused pipeline needs neither
+     padding nor convolution, reduced precision pads its own float copy of
+     the input and so needs the double one only for the check, and each
+     output needs only one of sharp and sharpCropped */
+  if (opts.storage == STORAGE_DOUBLE)
     {
-      for (j=0; j < ny; j++)
+      fuzzy = imagemalloc(nx, ny, sizeof(int));
+    }
+  if (!opts.fused)
+    {
+      convolution = imagemalloc(nx, ny, sizeof(double));
+    }
+  if (!opts.fused && (opts.precision == PRECISION_DOUBLE || opts.check))
+    {
+      fuzzyPadded = imagemalloc(nx+2*d, ny+2*d, sizeof(double));
+    }
+  if (!opts.fused || opts.output == OUTPUT_FULL)
+    {
+      sharp = imagemalloc(nx, ny, sizeof(double));
+    }
+  if (opts.output == OUTPUT_CROPPED)
+    {
+      sharpCropped = imagemalloc(nx-2*d, ny-2*d, sizeof(double));
+    }
+
+  /* Initialise image arrays, which the fused pipeline does not use */
+  if (!opts.fused)
+    {
+      for (i=0; i < nx; i++)
         {
-          fuzzy[i][j] = 0;
-          sharp[i][j] = 0.0;
-          convolution[i][j] = 0.0;
+          for (j=0; j < ny; j++)
+            {
+              fuzzy[i][j] = 0;
+              sharp[i][j] = 0.0;
+              convolution[i][j] = 0.0;
+            }
         }
     }
-  
-  printf("Using a filter of size %d x %d\n", 2*d+1, 2*d+1);
-  printf("\n");
 
   printf("Reading image file: %s\n", infile);
   fflush(stdout);
        
-  pgmread(infile, fuzzy, nx, ny, &xpix, &ypix);
+  if (opts.storage == STORAGE_UINT8)
+    {
+      fuzzyBytes = (unsigned char *) imagemalloc(nx, ny, sizeof(unsigned char));
+      fuzzyImage = fuzzyBytes;
+      pixbytes = sizeof(unsigned char);
+    }
+  else if (opts.storage == STORAGE_UINT16)
+    {
+      fuzzyShorts = (unsigned short *) imagemalloc(nx, ny, sizeof(unsigned short));
+      fuzzyImage = fuzzyShorts;
+      pixbytes = sizeof(unsigned short);
+    }
+  else
+    {
+      fuzzyImage = &fuzzy[0][0];
+      pixbytes = sizeof(int);
+    }
+
+  if (opts.layout == LAYOUT_ROWS)
+    {
+      /* The file is ny pixels wide and nx high, as the sizes were swapped */
+      pgmreadrows(infile, fuzzyImage, pixbytes, ny, nx, &ypix, &xpix);
+    }
+  else if (opts.storage == STORAGE_UINT8)
+    {
+      pgmreadbytes(infile, fuzzyBytes, nx, ny, &xpix, &ypix);
+    }
+  else if (opts.storage == STORAGE_UINT16)
+    {
+      pgmreadshorts(infile, fuzzyShorts, nx, ny, &xpix, &ypix);
+    }
+  else
+    {
+      pgmread(infile, fuzzy, nx, ny, &xpix, &ypix);
+    }
   printf("... done\n\n");
   fflush(stdout);
   
@@ -74,22 +280,30 @@ void dosharpen(char *infile, int nx, int ny)
       exit(-1);
     }
   
-  /* Initialise image array */
-  for (i=0; i < nx+2*d; i++)
+  /* The fused pipeline reads the fuzzy image directly, and reduced
+     precision pads its own copy, so neither may need this padding */
+  if (NULL != fuzzyPadded)
     {
-      for (j=0; j < ny+2*d; j++)
+      /* Initialise image array */
+      for (i=0; i < nx+2*d; i++)
         {
-          fuzzyPadded[i][j] = 0.0;
+          for (j=0; j < ny+2*d; j++)
+            {
+              fuzzyPadded[i][j] = 0.0;
+            }
         }
-    }
   
-  /* Transfer fuzzy image into padded array */
-  for (i=0; i < nx; i++)
-    { 
-      for (j=0; j < ny; j++)
-        {
-          fuzzyPadded[i+d][j+d] = fuzzy[i][j];
+      /* Transfer fuzzy image into padded array */
+      for (i=0; i < nx; i++)
+        { 
+          for (j=0; j < ny; j++)
+            {
+              fuzzyPadded[i+d][j+d] = fuzzy[i][j];
+            }
         }
+
+      /* Replace the zero border if some other boundary treatment was chosen */
+      padboundary(opts.boundary, &fuzzyPadded[0][0], nx, ny, d);
     }
   
   printf("Starting calculation ...\n");
@@ -102,35 +316,71 @@ void dosharpen(char *infile, int nx, int ny)
 
   tstart = omp_get_wtime();
 
-  /* Start of parallel region where filter is applied to fuzzy image */
+  if (opts.fused && opts.output == OUTPUT_FULL)
+    {
+      sharpenfusedfull(fuzzyImage, opts.storage, &sharp[0][0], nx, ny, d, scale/norm, opts.boundary);
+    }
+  else if (opts.storage == STORAGE_UINT8)
+    {
+      sharpenfusedbytes(fuzzyBytes, &sharpCropped[0][0], nx, ny, d, scale/norm);
+    }
+  else if (opts.storage == STORAGE_UINT16)
+    {
+      sharpenfusedshorts(fuzzyShorts, &sharpCropped[0][0], nx, ny, d, scale/norm);
+    }
+  else if (opts.fused)
+    {
+      sharpenfused(&fuzzy[0][0], &sharpCropped[0][0], nx, ny, d, scale/norm);
+    }
+  else if (opts.precision != PRECISION_DOUBLE)
+    {
+      convsingle(opts.precision, opts.boundary, &fuzzy[0][0], &convolution[0][0], nx, ny, d);
+    }
+  else if (opts.schedule != SCHEDULE_CYCLIC)
+    {
+      convworkshare(opts.schedule, &fuzzyPadded[0][0], &convolution[0][0], nx, ny, d,
+                    opts.tilei, opts.tilej);
+    }
+  else if (engine == ENGINE_DIRECT)
+    {
+      /* Use the precomputed coefficients rather than calling filter() for every tap */
+      w = getfilter(d)->w;
+
+      /* Start of parallel region where filter is applied to fuzzy image */
 #pragma omp parallel private(i, j, k, l, pixcount, threadid)
-{
-  nthreads  = omp_get_num_threads();
-  threadid = omp_get_thread_num();
-  
-  pixcount = 0;
-  
-  for (i=0; i < nx; i++)
     {
-      for (j=0; j < ny; j++)
+      nthreads  = omp_get_num_threads();
+      threadid = omp_get_thread_num();
+
+      pixcount = 0;
+
+      for (i=0; i < nx; i++)
         {
-          /* Computation of convolution allocated to threads using simple cyclic distribution
-             i.e. consecutively numbered threads take turns computing convolution for consecutive pixels */
-          if (pixcount%nthreads  == threadid)
+          for (j=0; j < ny; j++)
             {
-              for (k=-d; k <= d; k++)
+              /* Computation of convolution allocated to threads using simple cyclic distribution
+                 i.e. consecutively numbered threads take turns computing convolution for consecutive pixels */
+              if (pixcount%nthreads  == threadid)
                 {
-                  for (l= -d; l <= d; l++)
+                  for (k=-d; k <= d; k++)
                     {
-                      convolution[i][j] = convolution[i][j] + filter(d,k,l)*fuzzyPadded[i+d+k][j+d+l];
+                      for (l= -d; l <= d; l++)
+                        {
+                          convolution[i][j] = convolution[i][j] + w[(k+d)*(2*d+1)+(l+d)]*fuzzyPadded[i+d+k][j+d+l];
+                        }
                     }
                 }
+              pixcount += 1;
             }
-          pixcount += 1;
         }
     }
-}
-  /* End of parallel region and convolution computation */
+      /* End of parallel region and convolution computation */
+    }
+  else
+    {
+      /* The other engines contain their own parallel regions */
+      convolve(engine, &fuzzyPadded[0][0], &convolution[0][0], nx, ny, d);
+    }
   
   tstop = omp_get_wtime();
   time = tstop - tstart;
@@ -138,32 +388,74 @@ void dosharpen(char *infile, int nx, int ny)
   printf("... finished\n");
   printf("\n");
   fflush(stdout);
+
+  if (opts.check)
+    {
+      checkconvolution(&fuzzyPadded[0][0], &convolution[0][0], nx, ny, d, scale/norm);
+    }
   
-  /* Add rescaled convolution to fuzzy image to obtain sharp image */
-  for (i=0 ; i < nx; i++)
+  /* Add rescaled convolution to fuzzy image to obtain sharp image; the
+     fused pipeline has already written the result */
+  if (!opts.fused)
     {
-      for (j=0; j < ny; j++)
+      for (i=0 ; i < nx; i++)
         {
-          sharp[i][j] = fuzzyPadded[i+d][j+d] - scale/norm * convolution[i][j];
+          for (j=0; j < ny; j++)
+            {
+              sharp[i][j] = fuzzy[i][j] - scale/norm * convolution[i][j];
+            }
         }
     }
   
   printf("Writing output file: %s\n", outfile);
   printf("\n");
   
-  /* Only save the core of the sharpened image to remove edge effects */
-  for (i=d ; i < nx-d; i++)
+  /* Unless the full image was asked for, only save the core of the sharpened
+     image to remove edge effects */
+  if (!opts.fused && opts.output == OUTPUT_CROPPED)
     {
-      for (j=d; j < ny-d; j++)
+      for (i=d ; i < nx-d; i++)
         {
-          sharpCropped[i-d][j-d] = sharp[i][j];
+          for (j=d; j < ny-d; j++)
+            {
+              sharpCropped[i-d][j-d] = sharp[i][j];
+            }
         }
     }
   
-  pgmwrite(outfile, sharpCropped, nx-2*d, ny-2*d);
+  if (opts.layout == LAYOUT_ROWS)
+    {
+      /* Already in file order, ny pixels wide */
+      if (opts.output == OUTPUT_FULL)
+        {
+          pgmwriterows(outfile, sharp, ny, nx);
+        }
+      else
+        {
+          pgmwriterows(outfile, sharpCropped, ny-2*d, nx-2*d);
+        }
+    }
+  else if (opts.output == OUTPUT_FULL)
+    {
+      pgmwrite(outfile, sharp, nx, ny);
+    }
+  else
+    {
+      pgmwrite(outfile, sharpCropped, nx-2*d, ny-2*d);
+    }
   
   printf("... done\n");
   printf("\n");
   printf("Calculation time was %f seconds\n", time);
   fflush(stdout);
+
+  free(fuzzy);
+  free(fuzzyPadded);
+  free(convolution);
+  free(sharp);
+  free(sharpCropped);
+  free(fuzzyBytes);
+  free(fuzzyShorts);
+
+  freefilterbanks();
 }
@@ -0,0 +1,67 @@
+/*  Sharpening straight from a memory-mapped input file.
+ *
+ *  The pixels of an 8-bit P5 file are used in place: the file is mapped
+ *  into memory and the fused pipeline (see fused.c) reads the bytes
+ *  directly from the mapping, so the image is never copied into an int
+ *  array or a padded double array. If the file is already in the page
+ *  cache nothing at all is read from disk.
+ *
+ *  The mapping holds the image in file order, one row of nx pixels
+ *  after another, which is the transpose of the x[i][j] arrays used
+ *  elsewhere. As the filter and boundary treatments are the same in
+ *  both directions the fused kernels are simply applied to it with the
+ *  roles of nx and ny swapped, and the result, which is also in file
+ *  order, is written with pgmwriterows.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "sharpen.h"
+
+void sharpenmapped(char *infile, char *outfile, int nx, int ny, int d,
+                   double factor, int output, int boundary)
+{
+  unsigned char *pixels;
+  double *sharp;
+  void *map;
+  size_t maplen;
+  int nxt, nyt;
+
+  pixels = pgmmap(infile, &nxt, &nyt, &map, &maplen);
+
+  if (nxt != nx || nyt != ny)
+  {
+    fprintf(stderr, "sharpenmapped: <%s> is not a %d x %d image\n", infile, nx, ny);
+    exit(-1);
+  }
+
+  if (output == OUTPUT_FULL)
+  {
+    sharp = (double *) malloc((long) nx*ny*sizeof(double));
+  }
+  else
+  {
+    sharp = (double *) malloc((long) (nx-2*d)*(ny-2*d)*sizeof(double));
+  }
+
+  if (NULL == sharp)
+  {
+    fprintf(stderr, "sharpenmapped: cannot allocate output image\n");
+    exit(-1);
+  }
+
+  if (output == OUTPUT_FULL)
+  {
+    sharpenfusedfull(pixels, STORAGE_UINT8, sharp, ny, nx, d, factor, boundary);
+    pgmwriterows(outfile, sharp, nx, ny);
+  }
+  else
+  {
+    sharpenfusedbytes(pixels, sharp, ny, nx, d, factor);
+    pgmwriterows(outfile, sharp, nx-2*d, ny-2*d);
+  }
+
+  pgmunmap(map, maplen);
+
+  free(sharp);
+}
@@ -0,0 +1,237 @@
+/*  Run-time options.
+ *
+ *  These are read from environment variables so that they can be set
+ *  in a job script in the same way as OMP_NUM_THREADS, and so that the
+ *  parallel versions see the same settings on every process without
+ *  any extra communication. Any option that is not set keeps the
+ *  behaviour of the original program.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sharpen.h"
+
+static char *enginenames[] = {"direct", "separable", "fft", "auto", "simd",
+                              "tiled", "iir", "fixed"};
+static char *precisionnames[] = {"double", "single", "compensated", "mixed"};
+static char *isachoices[]  = {"scalar", "sse2", "avx2", "avx512", "auto"};
+static char *storagenames[] = {"double", "uint8", "uint16", "auto"};
+static char *boundarynames[] = {"zero", "clamp", "mirror", "wrap"};
+static char *outputnames[]   = {"cropped", "full"};
+static char *inputnames[]    = {"read", "mmap"};
+static char *layoutnames[]   = {"transposed", "rows"};
+static char *schedulenames[] = {"cyclic", "static", "dynamic", "guided", "steal"};
+
+#define NENGINE    (int) (sizeof(enginenames)/sizeof(enginenames[0]))
+#define NPRECISION (int) (sizeof(precisionnames)/sizeof(precisionnames[0]))
+#define NISA       (int) (sizeof(isachoices)/sizeof(isachoices[0]))
+#define NSTORAGE   (int) (sizeof(storagenames)/sizeof(storagenames[0]))
+#define NBOUNDARY  (int) (sizeof(boundarynames)/sizeof(boundarynames[0]))
+#define NOUTPUT    (int) (sizeof(outputnames)/sizeof(outputnames[0]))
+#define NINPUT     (int) (sizeof(inputnames)/sizeof(inputnames[0]))
+#define NLAYOUT    (int) (sizeof(layoutnames)/sizeof(layoutnames[0]))
+#define NSCHEDULE  (int) (sizeof(schedulenames)/sizeof(schedulenames[0]))
+
+/*
+ *  Return the index of the value of environment variable "name" in the
+ *  list of choices, or "def" if it is not set. Stop on unknown values
+ *  rather than silently running something different.
+ */
+
+static int getenvchoice(char *name, char **choices, int nchoice, int def)
+{
+  char *value;
+  int i;
+
+  value = getenv(name);
+
+  if (NULL == value || 0 == strlen(value)) return def;
+
+  for (i=0; i < nchoice; i++)
+  {
+    if (0 == strcmp(value, choices[i])) return i;
+  }
+
+  fprintf(stderr, "getoptions: unknown value %s=%s, valid values are:", name, value);
+  for (i=0; i < nchoice; i++) fprintf(stderr, " %s", choices[i]);
+  fprintf(stderr, "\n");
+
+  exit(-1);
+}
+
+static int getenvint(char *name, int def)
+{
+  char *value, *end;
+  long ival;
+
+  value = getenv(name);
+
+  if (NULL == value || 0 == strlen(value)) return def;
+
+  ival = strtol(value, &end, 10);
+
+  if (*end != '\0')
+  {
+    fprintf(stderr, "getoptions: %s=%s is not an integer\n", name, value);
+    exit(-1);
+  }
+
+  return (int) ival;
+}
+
+sharpenopts getoptions(void)
+{
+  sharpenopts opts;
+
+  opts.range  = getenvint("SHARPEN_RANGE", 8);
+  opts.engine = getenvchoice("SHARPEN_ENGINE", enginenames, NENGINE, ENGINE_DIRECT);
+  opts.isa    = getenvchoice("SHARPEN_ISA", isachoices, NISA, ISA_AUTO);
+  opts.tilei  = getenvint("SHARPEN_TILE_I", 0);
+  opts.tilej  = getenvint("SHARPEN_TILE_J", 0);
+  opts.check  = getenvint("SHARPEN_CHECK", 0);
+  opts.fused  = getenvint("SHARPEN_FUSED", 0);
+  opts.stream = getenvint("SHARPEN_STREAM", 0);
+  opts.memory = getenvint("SHARPEN_MEMORY", 64);
+
+  opts.precision = getenvchoice("SHARPEN_PRECISION", precisionnames, NPRECISION,
+                                PRECISION_DOUBLE);
+
+  opts.storage = getenvchoice("SHARPEN_STORAGE", storagenames, NSTORAGE, STORAGE_DOUBLE);
+
+  opts.boundary = getenvchoice("SHARPEN_BOUNDARY", boundarynames, NBOUNDARY, BOUNDARY_ZERO);
+  opts.output   = getenvchoice("SHARPEN_OUTPUT", outputnames, NOUTPUT, OUTPUT_CROPPED);
+  opts.input    = getenvchoice("SHARPEN_INPUT", inputnames, NINPUT, INPUT_READ);
+  opts.layout   = getenvchoice("SHARPEN_LAYOUT", layoutnames, NLAYOUT, LAYOUT_TRANSPOSED);
+  opts.schedule = getenvchoice("SHARPEN_SCHEDULE", schedulenames, NSCHEDULE, SCHEDULE_CYCLIC);
+
+  /* Integer storage, streaming and mapped input are only implemented for the fused pipeline */
+
+  if (opts.storage != STORAGE_DOUBLE || opts.stream || opts.input == INPUT_MMAP) opts.fused = 1;
+
+  if (opts.range < 1)
+  {
+    fprintf(stderr, "getoptions: SHARPEN_RANGE must be positive\n");
+    exit(-1);
+  }
+
+  /* Deriche's filters are no longer accurate for the narrow filter of range 1 */
+
+  if (opts.engine == ENGINE_IIR && opts.range < 2)
+  {
+    fprintf(stderr, "getoptions: SHARPEN_ENGINE=iir needs SHARPEN_RANGE of at least 2\n");
+    exit(-1);
+  }
+
+  if (opts.precision != PRECISION_DOUBLE && opts.engine != ENGINE_DIRECT)
+  {
+    fprintf(stderr, "getoptions: SHARPEN_PRECISION=%s needs SHARPEN_ENGINE=direct\n",
+            precisionnames[opts.precision]);
+    exit(-1);
+  }
+
+  if (opts.fused && (opts.engine != ENGINE_DIRECT || opts.precision != PRECISION_DOUBLE))
+  {
+    fprintf(stderr, "getoptions: the fused pipeline (SHARPEN_FUSED, SHARPEN_STORAGE, SHARPEN_STREAM "
+                    "or SHARPEN_INPUT=mmap) "
+                    "needs SHARPEN_ENGINE=direct and SHARPEN_PRECISION=double\n");
+    exit(-1);
+  }
+
+  if (opts.stream && opts.memory < 1)
+  {
+    fprintf(stderr, "getoptions: SHARPEN_MEMORY must be positive\n");
+    exit(-1);
+  }
+
+  if (opts.stream && opts.output == OUTPUT_FULL)
+  {
+    fprintf(stderr, "getoptions: SHARPEN_OUTPUT=full cannot be used with SHARPEN_STREAM=1\n");
+    exit(-1);
+  }
+
+  if (opts.stream && opts.input == INPUT_MMAP)
+  {
+    fprintf(stderr, "getoptions: SHARPEN_INPUT=mmap cannot be used with SHARPEN_STREAM=1\n");
+    exit(-1);
+  }
+
+#ifndef _OPENMP
+  /* Without threads there is nothing to share out */
+
+  if (opts.schedule != SCHEDULE_CYCLIC)
+  {
+    fprintf(stderr, "getoptions: SHARPEN_SCHEDULE=%s needs a build with OpenMP\n",
+            schedulenames[opts.schedule]);
+    exit(-1);
+  }
+#endif
+
+  if (opts.schedule != SCHEDULE_CYCLIC &&
+      (opts.engine != ENGINE_DIRECT || opts.precision != PRECISION_DOUBLE || opts.fused))
+  {
+    fprintf(stderr, "getoptions: SHARPEN_SCHEDULE=%s needs SHARPEN_ENGINE=direct, "
+                    "SHARPEN_PRECISION=double and not the fused pipeline\n",
+            schedulenames[opts.schedule]);
+    exit(-1);
+  }
+
+  /* As for the other options, stop rather than silently ignore these */
+
+  if (opts.isa != ISA_AUTO && opts.engine != ENGINE_SIMD)
+  {
+    fprintf(stderr, "getoptions: SHARPEN_ISA=%s needs SHARPEN_ENGINE=simd\n", isachoices[opts.isa]);
+    exit(-1);
+  }
+
+  if ((opts.tilei != 0 || opts.tilej != 0) &&
+      opts.engine != ENGINE_TILED && opts.schedule == SCHEDULE_CYCLIC)
+  {
+    fprintf(stderr, "getoptions: SHARPEN_TILE_I and SHARPEN_TILE_J need SHARPEN_ENGINE=tiled "
+                    "or a SHARPEN_SCHEDULE other than cyclic\n");
+    exit(-1);
+  }
+
+  if (opts.fused && opts.check)
+  {
+    fprintf(stderr, "getoptions: SHARPEN_CHECK=1 cannot be used with the fused pipeline\n");
+    exit(-1);
+  }
+
+  return opts;
+}
+
+char *precisionname(int precision)
+{
+  if (precision < 0 || precision >= NPRECISION) return "unknown";
+
+  return precisionnames[precision];
+}
+
+char *enginename(int engine)
+{
+  if (engine < 0 || engine >= NENGINE) return "unknown";
+
+  return enginenames[engine];
+}
+
+char *storagename(int storage)
+{
+  if (storage < 0 || storage >= NSTORAGE) return "unknown";
+
+  return storagenames[storage];
+}
+
+char *schedulename(int schedule)
+{
+  if (schedule < 0 || schedule >= NSCHEDULE) return "unknown";
+
+  return schedulenames[schedule];
+}
+
+char *boundaryname(int boundary)
+{
+  if (boundary < 0 || boundary >= NBOUNDARY) return "unknown";
+
+  return boundarynames[boundary];
+}
@@ -0,0 +1,139 @@
+/*  Reduced-precision direct convolution.
+ *
+ *  The input pixels are 8-bit integers and the output is quantised back
+ *  to 8 bits, so the convolution does not really need double precision.
+ *  Here the padded image is built as floats straight from the integer
+ *  image, with the same boundary treatment as padboundary, so no double
+ *  padded array is needed. With the coefficients also stored as floats
+ *  this halves the memory and memory traffic for the input and doubles
+ *  the number of values per vector register. The convolution is still
+ *  returned in double, as the sharpened image and the output routines
+ *  are shared with the double precision pipeline. There are three
+ *  choices for the accumulation:
+ *
+ *    PRECISION_SINGLE       plain float sums
+ *    PRECISION_COMPENSATED  float sums with Kahan compensation, which
+ *                           recovers most of the accuracy lost by
+ *                           rounding each partial sum to float
+ *    PRECISION_MIXED        double sums of float products
+ *
+ *  The loops run along j innermost, i.e. across neighbouring output
+ *  pixels, so that they vectorise without reordering any pixel's sum.
+ *  Kahan summation must not be compiled with -ffast-math, which allows
+ *  the compensation to be optimised away.
+ *
+ *  Use SHARPEN_CHECK=1 to report the difference from the double
+ *  precision calculation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "sharpen.h"
+
+void convsingle(int precision, int boundary, int *fuzzy, double *conv, int nx, int ny, int d)
+{
+  float *wf = getfilter(d)->wf;
+
+  int nxp = nx+2*d;
+  int nyp = ny+2*d;
+  int nw  = 2*d+1;
+
+  float *paddedf, *in, *fsum, *comp;
+  float wkl, y, t;
+  double *dsum;
+  int i, j, k, l, bi, bj;
+
+  paddedf = (float *) malloc((long) nxp*nyp*sizeof(float));
+
+  if (NULL == paddedf)
+  {
+    fprintf(stderr, "convsingle: cannot allocate %d x %d image\n", nxp, nyp);
+    exit(-1);
+  }
+
+#pragma omp parallel \
+  shared(precision, boundary, fuzzy, paddedf, conv, wf, nx, ny, nxp, nyp, nw, d) \
+  private(in, fsum, comp, dsum, wkl, y, t, i, j, k, l, bi, bj)
+  {
+#pragma omp for
+    for (i=0; i < nxp; i++)
+    {
+      bi = boundaryindex(boundary, i-d, nx);
+
+      for (j=0; j < nyp; j++)
+      {
+        bj = boundaryindex(boundary, j-d, ny);
+
+        paddedf[(long) i*nyp+j] = (bi < 0 || bj < 0) ? 0.0f : (float) fuzzy[(long) bi*ny+bj];
+      }
+    }
+
+    fsum = (float *)  malloc(ny*sizeof(float));
+    comp = (float *)  malloc(ny*sizeof(float));
+    dsum = (double *) malloc(ny*sizeof(double));
+
+    if (NULL == fsum || NULL == comp || NULL == dsum)
+    {
+      fprintf(stderr, "convsingle: cannot allocate sums for a row of %d pixels\n", ny);
+      exit(-1);
+    }
+
+#pragma omp for
+    for (i=0; i < nx; i++)
+    {
+      for (j=0; j < ny; j++)
+      {
+        fsum[j] = 0.0f;
+        comp[j] = 0.0f;
+        dsum[j] = 0.0;
+      }
+
+      for (k=0; k < nw; k++)
+      {
+        for (l=0; l < nw; l++)
+        {
+          wkl = wf[k*nw+l];
+          in  = &paddedf[(long) (i+k)*nyp + l];
+
+          switch (precision)
+          {
+            case PRECISION_SINGLE:
+              for (j=0; j < ny; j++)
+              {
+                fsum[j] = fsum[j] + wkl*in[j];
+              }
+              break;
+
+            case PRECISION_COMPENSATED:
+              for (j=0; j < ny; j++)
+              {
+                y = wkl*in[j] - comp[j];
+                t = fsum[j] + y;
+                comp[j] = (t - fsum[j]) - y;
+                fsum[j] = t;
+              }
+              break;
+
+            case PRECISION_MIXED:
+              for (j=0; j < ny; j++)
+              {
+                dsum[j] = dsum[j] + (double) (wkl*in[j]);
+              }
+              break;
+          }
+        }
+      }
+
+      for (j=0; j < ny; j++)
+      {
+        conv[(long) i*ny+j] = (precision == PRECISION_MIXED) ? dsum[j] : (double) fsum[j];
+      }
+    }
+
+    free(fsum);
+    free(comp);
+    free(dsum);
+  }
+
+  free(paddedf);
+}
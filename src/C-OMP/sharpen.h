@@ -1,6 +1,165 @@
 void pgmsize(char *filename, int *nx, int *ny);
+typedef struct pgmfile pgmfile;
+pgmfile *pgmopen(char *filename, int *nx, int *ny, int *maxval);
+void pgmreadpixels(pgmfile *pf, int *pixels, long n);
+pgmfile *pgmcreate(char *filename, int nx, int ny, int maxval);
+void pgmwritepixels(pgmfile *pf, int *grey, long n);
+void pgmclose(pgmfile *pf);
+long pgmoffset(pgmfile *pf, int *binary);
+int pgmbinaryformat(void);
 void pgmread(char *filename, void *vp, int nxmax, int nymax, int *nx, int *ny);
+void pgmreadbytes(char *filename, void *vp, int nxmax, int nymax, int *nx, int *ny);
+void pgmreadshorts(char *filename, void *vp, int nxmax, int nymax, int *nx, int *ny);
+void pgmreadrows(char *filename, void *vp, int width, int nxmax, int nymax, int *nx, int *ny);
+int pgmmaxval(void);
 void pgmwrite(char *filename, void *vx, int nx, int ny);
+void pgmwriterows(char *filename, void *vx, int nx, int ny);
+unsigned char *pgmmap(char *filename, int *nx, int *ny, void **map, size_t *maplen);
+void pgmunmap(void *map, size_t maplen);
+int pgmgrey(double tmp, double xmin, double xmax, double thresh);
 
 void dosharpen(char *filename, int nx, int ny);
 double filter(int d, int i, int j);
+
+/* Precomputed filter coefficients, see filterbank.c */
+
+typedef struct
+{
+  int d;
+  double sigma, filter0;
+  double *w;
+  float *wf;
+} filterbank;
+
+double filtersigma(int d);
+double filterpeak(void);
+double filterfunc(double sigma, double filter0, int i, int j);
+
+filterbank *getfilterbank(int d, double sigma, double filter0);
+filterbank *getfilter(int d);
+void freefilterbanks(void);
+
+/* Run-time options, see options.c */
+
+#define ENGINE_DIRECT    0
+#define ENGINE_SEPARABLE 1
+#define ENGINE_FFT       2
+#define ENGINE_AUTO      3
+#define ENGINE_SIMD      4
+#define ENGINE_TILED     5
+#define ENGINE_IIR       6
+#define ENGINE_FIXED     7
+
+#define ISA_SCALAR 0
+#define ISA_SSE2   1
+#define ISA_AVX2   2
+#define ISA_AVX512 3
+#define ISA_AUTO   4
+
+#define PRECISION_DOUBLE      0
+#define PRECISION_SINGLE      1
+#define PRECISION_COMPENSATED 2
+#define PRECISION_MIXED       3
+
+#define STORAGE_DOUBLE 0
+#define STORAGE_UINT8  1
+#define STORAGE_UINT16 2
+#define STORAGE_AUTO   3
+
+#define BOUNDARY_ZERO   0
+#define BOUNDARY_CLAMP  1
+#define BOUNDARY_MIRROR 2
+#define BOUNDARY_WRAP   3
+
+#define OUTPUT_CROPPED 0
+#define OUTPUT_FULL    1
+
+#define INPUT_READ 0
+#define INPUT_MMAP 1
+
+#define LAYOUT_TRANSPOSED 0
+#define LAYOUT_ROWS       1
+
+#define SCHEDULE_CYCLIC  0
+#define SCHEDULE_STATIC  1
+#define SCHEDULE_DYNAMIC 2
+#define SCHEDULE_GUIDED  3
+#define SCHEDULE_STEAL   4
+
+typedef struct
+{
+  int range;
+  int engine;
+  int isa;
+  int tilei, tilej;
+  int check;
+  int precision;
+  int fused;
+  int storage;
+  int stream;
+  int memory;
+  int boundary;
+  int output;
+  int input;
+  int layout;
+  int schedule;
+} sharpenopts;
+
+sharpenopts getoptions(void);
+char *enginename(int engine);
+char *precisionname(int precision);
+char *storagename(int storage);
+char *boundaryname(int boundary);
+char *schedulename(int schedule);
+
+/* Alternative convolution engines, see convolve.c */
+
+int selectengine(int engine, int nx, int ny, int d);
+void convolve(int engine, double *padded, double *conv, int nx, int ny, int d);
+void checkconvolution(double *padded, double *conv, int nx, int ny, int d, double factor);
+void convseparable(double *padded, double *conv, int nx, int ny, int d);
+void convfft(double *padded, double *conv, int nx, int ny, int d);
+int fftcrossover(int nx, int ny, int d);
+void convsimd(double *padded, double *conv, int nx, int ny, int d);
+int selectisa(int isa);
+char *isaname(int isa);
+void convtiled(double *padded, double *conv, int nx, int ny, int d);
+void selecttiles(int *ti, int *tj, int d);
+void convworkshare(int schedule, double *padded, double *conv,
+                   int nx, int ny, int d, int ti, int tj);
+void selectworktiles(int *ti, int *tj);
+void conviir(double *padded, double *conv, int nx, int ny, int d);
+void convfixed(double *padded, double *conv, int nx, int ny, int d);
+int fixedspecialised(int d);
+void convsingle(int precision, int boundary, int *fuzzy, double *conv, int nx, int ny, int d);
+void sharpenfused(int *fuzzy, double *sharp, int nx, int ny, int d, double factor);
+void sharpenfusedbytes(unsigned char *fuzzy, double *sharp, int nx, int ny, int d, double factor);
+void sharpenfusedshorts(unsigned short *fuzzy, double *sharp, int nx, int ny, int d, double factor);
+void sharpenfusedfull(void *fuzzy, int storage, double *sharp,
+                      int nx, int ny, int d, double factor, int boundary);
+int boundaryindex(int boundary, int i, int n);
+void padboundary(int boundary, double *padded, int nx, int ny, int d);
+void sharpenmapped(char *infile, char *outfile, int nx, int ny, int d,
+                   double factor, int output, int boundary);
+int streamband(int nx, int ny, int d, int maxval, int mbytes);
+void sharpenstream(char *infile, char *outfile, int nx, int ny, int d, double factor, int band);
+
+int  **int2Dmalloc(int nx, int ny);
+double **double2Dmalloc(int nx, int ny);
+
+/* Work-stealing scheduler for tiles, see steal.c */
+
+typedef void (*stealtask)(void *arg, int tile, int thread);
+
+typedef struct
+{
+  long tiles;
+  long steals;
+  long attempts;
+  double busy;
+} stealstats;
+
+int stealrun(int first, int last, stealtask task, void *arg, stealstats *stats);
+void stealreport(stealstats *stats, int nthread);
+int stealtilecount(int nx, int ny, int ti, int tj);
+void stealtilebounds(int t, int nx, int ny, int ti, int tj, int *i0, int *i1, int *j0, int *j1);
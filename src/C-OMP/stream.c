@@ -0,0 +1,185 @@
+/*  Out-of-core sharpening for images too large to hold in memory.
+ *
+ *  The input file is read a band of rows at a time. Each band of output
+ *  rows needs the corresponding input rows plus d more on either side,
+ *  so the window in memory is the band plus 2d rows; after each band
+ *  the last 2d rows are kept and the next rows read in after them. The
+ *  output rows are computed with the fused pipeline (see fused.c), and
+ *  as the filter is symmetric it can be applied to the rows in the
+ *  order they come from the file.
+ *
+ *  The output grey levels are scaled by the largest and smallest values
+ *  in the whole sharpened image, which are not known until the end, so
+ *  the image is streamed twice: the first pass only finds the range of
+ *  values and the second writes them. This doubles the calculation but
+ *  keeps the memory needed independent of the number of rows.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sharpen.h"
+
+/*
+ *  Open the PGM file and check that it is the size expected, returning
+ *  its maximum grey level.
+ */
+
+static pgmfile *streamopen(char *filename, int nx, int ny, int *maxval)
+{
+  pgmfile *pf;
+  int nxt, nyt;
+
+  pf = pgmopen(filename, &nxt, &nyt, maxval);
+
+  if (nxt != nx || nyt != ny)
+  {
+    fprintf(stderr, "sharpenstream: <%s> is not a %d x %d image\n", filename, nx, ny);
+    exit(-1);
+  }
+
+  return pf;
+}
+
+/*
+ *  Bytes allocated to stream a band of rows of an nx pixel wide image
+ *  with maximum grey level maxval: the input window, the sharpened,
+ *  grey level and text output of the band, and the buffers of the input
+ *  and output files (see cio.c). "%3d " takes the larger of four
+ *  characters and one more than the digits of maxval, and allowing one
+ *  more for newlines bounds the text written by pgmwritepixels.
+ */
+
+#define STREAMFILEBUF (2*1024*1024)
+
+static double streambytes(int nx, int d, int maxval, int band)
+{
+  int nxs = nx-2*d;
+  int width = 4;
+  int grey;
+
+  for (grey=maxval; grey >= 1000; grey /= 10) width++;
+
+  return (double) (band+2*d)*nx*sizeof(int)
+       + (double) band*nxs*(sizeof(double) + sizeof(int) + width+1)
+       + STREAMFILEBUF;
+}
+
+/*
+ *  Choose the number of output rows per band so that everything that
+ *  streambytes counts fits in the memory budget of mbytes megabytes.
+ *  Stops if not even one row fits.
+ */
+
+int streamband(int nx, int ny, int d, int maxval, int mbytes)
+{
+  double budget = (double) mbytes*1024.0*1024.0;
+  double fixed  = streambytes(nx, d, maxval, 0);
+  double perrow = streambytes(nx, d, maxval, 1) - fixed;
+  int band;
+
+  if (fixed + perrow > budget)
+  {
+    fprintf(stderr, "streamband: SHARPEN_MEMORY=%d is too small to stream a %d pixel wide image, "
+                    "which needs at least %d MB\n", mbytes, nx, (int) ceil((fixed+perrow)/(1024.0*1024.0)));
+    exit(-1);
+  }
+
+  band = (int) ((budget-fixed)/perrow);
+
+  if (band > ny-2*d) band = ny-2*d;
+
+  return band;
+}
+
+/*
+ *  Sharpen the nx x ny image in infile and write the cropped result to
+ *  outfile, holding at most band output rows in memory at a time.
+ */
+
+void sharpenstream(char *infile, char *outfile, int nx, int ny, int d,
+                   double factor, int band)
+{
+  pgmfile *fin, *fout;
+
+  int nxs = nx-2*d;
+  int nys = ny-2*d;
+
+  int *window, *grey;
+  double *sharp;
+
+  double xmin, xmax, thresh;
+  int pass, row, nrow, maxval;
+  long i;
+
+  window = (int *) malloc((long) (band+2*d)*nx*sizeof(int));
+  sharp  = (double *) malloc((long) band*nxs*sizeof(double));
+  grey   = (int *) malloc((long) band*nxs*sizeof(int));
+
+  if (NULL == window || NULL == sharp || NULL == grey)
+  {
+    fprintf(stderr, "sharpenstream: cannot allocate band of %d rows\n", band);
+    exit(-1);
+  }
+
+  xmin = xmax = 0.0;
+  fout = NULL;
+
+  for (pass=0; pass < 2; pass++)
+  {
+    fin = streamopen(infile, nx, ny, &maxval);
+    thresh = maxval;
+
+    if (pass == 1)
+    {
+      fout = pgmcreate(outfile, nxs, nys, (int) thresh);
+    }
+
+    /* Start the window with the first 2d rows */
+
+    pgmreadpixels(fin, window, (long) 2*d*nx);
+
+    for (row=0; row < nys; row += nrow)
+    {
+      nrow = band;
+      if (row+nrow > nys) nrow = nys-row;
+
+      pgmreadpixels(fin, &window[(long) 2*d*nx], (long) nrow*nx);
+
+      sharpenfused(window, sharp, nrow+2*d, nx, d, factor);
+
+      if (pass == 0)
+      {
+        if (row == 0) xmin = xmax = fabs(sharp[0]);
+
+        for (i=0; i < (long) nrow*nxs; i++)
+        {
+          if (fabs(sharp[i]) < xmin) xmin = fabs(sharp[i]);
+          if (fabs(sharp[i]) > xmax) xmax = fabs(sharp[i]);
+        }
+      }
+      else
+      {
+        for (i=0; i < (long) nrow*nxs; i++)
+        {
+          grey[i] = pgmgrey(sharp[i], xmin, xmax, thresh);
+        }
+
+        pgmwritepixels(fout, grey, (long) nrow*nxs);
+      }
+
+      /* Keep the last 2d rows for the next band */
+
+      memmove(window, &window[(long) nrow*nx], (long) 2*d*nx*sizeof(int));
+    }
+
+    pgmclose(fin);
+  }
+
+  pgmclose(fout);
+
+  free(window);
+  free(sharp);
+  free(grey);
+}
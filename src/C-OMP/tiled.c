@@ -0,0 +1,188 @@
+/*  Cache-tiled, register-blocked direct convolution.
+ *
+ *  The output image is divided into tiles of tilei x tilej pixels,
+ *  sized so that the input pixels needed by a tile stay in the L2
+ *  cache. Within a tile, each step of the micro-kernel computes a block
+ *  of MR x NR output pixels: every input value loaded is used for all
+ *  the output rows of the block that need it before moving on, so each
+ *  row of input is read once per block rather than once per pixel. The
+ *  output rows that an input row contributes to are worked out before
+ *  the inner loops, which therefore have no branches and vectorise.
+ *
+ *  Each output pixel still accumulates its taps in the same order as
+ *  the loop in dosharpen, so the result is identical.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "sharpen.h"
+
+#define MR 4
+#define NR 8
+
+/* Used if the L2 cache size cannot be found from the system */
+
+#define DEFAULTL2 (256*1024)
+
+static int tilei = 0, tilej = 0;
+
+/*
+ *  Choose the tile sizes for a filter of range d. Positive values are
+ *  used as given, and zero values are set so that the (tile+2d)^2 input
+ *  values of a square tile fill about half the L2 cache. The sizes
+ *  used are returned in *ti and *tj.
+ */
+
+void selecttiles(int *ti, int *tj, int d)
+{
+  long l2 = -1;
+  int t;
+
+#ifdef _SC_LEVEL2_CACHE_SIZE
+  l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+
+  if (l2 <= 0) l2 = DEFAULTL2;
+
+  for (t=MR*NR; (long) (t+MR*NR+2*d)*(t+MR*NR+2*d)*(long) sizeof(double) <= l2/2; t += MR*NR);
+
+  if (*ti <= 0) *ti = t;
+  if (*tj <= 0) *tj = t;
+
+  tilei = *ti;
+  tilej = *tj;
+}
+
+/*
+ *  Full MR x NR block with top left-hand output pixel (i0,j0). Input
+ *  row r of the block contributes to output row m with tap k = r-m,
+ *  for the rows max(0, r-2d) <= m <= min(MR-1, r).
+ */
+
+static void blockfull(double *w, double *padded, double *conv,
+                      int ny, int d, int i0, int j0)
+{
+  int nyp = ny+2*d;
+  int nw  = 2*d+1;
+
+  double acc[MR][NR];
+  double *in, *wk;
+
+  int r, m, n, l, mlo, mhi;
+
+  for (m=0; m < MR; m++)
+  {
+    for (n=0; n < NR; n++) acc[m][n] = 0.0;
+  }
+
+  for (r=0; r < MR+2*d; r++)
+  {
+    in = &padded[(long) (i0+r)*nyp + j0];
+
+    mlo = (r-2*d > 0) ? r-2*d : 0;
+    mhi = (r < MR-1) ? r : MR-1;
+
+    for (m=mlo; m <= mhi; m++)
+    {
+      wk = &w[(r-m)*nw];
+
+      for (l=0; l < nw; l++)
+      {
+        for (n=0; n < NR; n++) acc[m][n] = acc[m][n] + wk[l]*in[n+l];
+      }
+    }
+  }
+
+  for (m=0; m < MR; m++)
+  {
+    for (n=0; n < NR; n++) conv[(long) (i0+m)*ny + j0+n] = acc[m][n];
+  }
+}
+
+/*
+ *  Partial block of mr x nr pixels at the edges of the image.
+ */
+
+static void blockpartial(double *w, double *padded, double *conv,
+                         int ny, int d, int i0, int j0, int mr, int nr)
+{
+  int nyp = ny+2*d;
+  int nw  = 2*d+1;
+
+  double acc[MR][NR];
+  double *in, *wk;
+
+  int r, m, n, l, mlo, mhi;
+
+  for (m=0; m < mr; m++)
+  {
+    for (n=0; n < nr; n++) acc[m][n] = 0.0;
+  }
+
+  for (r=0; r < mr+2*d; r++)
+  {
+    in = &padded[(long) (i0+r)*nyp + j0];
+
+    mlo = (r-2*d > 0) ? r-2*d : 0;
+    mhi = (r < mr-1) ? r : mr-1;
+
+    for (m=mlo; m <= mhi; m++)
+    {
+      wk = &w[(r-m)*nw];
+
+      for (l=0; l < nw; l++)
+      {
+        for (n=0; n < nr; n++) acc[m][n] = acc[m][n] + wk[l]*in[n+l];
+      }
+    }
+  }
+
+  for (m=0; m < mr; m++)
+  {
+    for (n=0; n < nr; n++) conv[(long) (i0+m)*ny + j0+n] = acc[m][n];
+  }
+}
+
+void convtiled(double *padded, double *conv, int nx, int ny, int d)
+{
+  double *w = getfilter(d)->w;
+
+  int ti, tj, it, jt, i0, j0, mr, nr;
+
+  if (tilei <= 0 || tilej <= 0) selecttiles(&tilei, &tilej, d);
+
+  ti = tilei;
+  tj = tilej;
+
+#pragma omp parallel for collapse(2) schedule(dynamic) default(none) \
+  shared(w, padded, conv, nx, ny, d, ti, tj) private(it, jt, i0, j0, mr, nr)
+  for (it=0; it < nx; it += ti)
+  {
+    for (jt=0; jt < ny; jt += tj)
+    {
+      for (i0=it; i0 < it+ti && i0 < nx; i0 += MR)
+      {
+        mr = MR;
+        if (i0+mr > it+ti) mr = it+ti-i0;
+        if (i0+mr > nx)    mr = nx-i0;
+
+        for (j0=jt; j0 < jt+tj && j0 < ny; j0 += NR)
+        {
+          nr = NR;
+          if (j0+nr > jt+tj) nr = jt+tj-j0;
+          if (j0+nr > ny)    nr = ny-j0;
+
+          if (mr == MR && nr == NR)
+          {
+            blockfull(w, padded, conv, ny, d, i0, j0);
+          }
+          else
+          {
+            blockpartial(w, padded, conv, ny, d, i0, j0, mr, nr);
+          }
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,217 @@
+/*  Work-shared direct convolution.
+ *
+ *  The original parallel loop has every thread run over all nx x ny
+ *  pixels, computing only those for which pixcount%nthreads equals its
+ *  thread number. Every thread therefore pays for the whole loop, and
+ *  neighbouring pixels of the convolution are written by different
+ *  threads, so each cache line of output bounces between their caches.
+ *
+ *  Here the output is instead divided into tiles of tilei x tilej
+ *  pixels which are shared out by an OpenMP loop with a static, dynamic
+ *  or guided schedule. Each thread computes a tile into its own buffer,
+ *  aligned to a cache line, and copies it into the convolution once it
+ *  is finished, so no cache line is written by two threads while the
+ *  tiles are being computed. The width of a tile is a whole number of
+ *  cache lines.
+ *
+ *  With the steal schedule the tiles are instead handed out by the
+ *  work-stealing scheduler in steal.c, which also reports how many
+ *  tiles each thread computed and stole. None of the schedules are
+ *  available without OpenMP, where getoptions rejects them.
+ *
+ *  Each output pixel accumulates its taps in the same order as the loop
+ *  in dosharpen, so the result is identical.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "sharpen.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define CACHELINE 64
+#define LINEDOUBLES (CACHELINE/(int) sizeof(double))
+
+/* Used if SHARPEN_TILE_I or SHARPEN_TILE_J is zero */
+
+#define DEFAULTTILEI 32
+#define DEFAULTTILEJ 64
+
+/*
+ *  Choose the tile sizes, rounding the width up to whole cache lines.
+ *  The sizes used are returned in *ti and *tj.
+ */
+
+void selectworktiles(int *ti, int *tj)
+{
+  if (*ti <= 0) *ti = DEFAULTTILEI;
+  if (*tj <= 0) *tj = DEFAULTTILEJ;
+
+  *tj = LINEDOUBLES*((*tj+LINEDOUBLES-1)/LINEDOUBLES);
+}
+
+/*
+ *  Convolution of tile number t into the ti x tj buffer acc
+ */
+
+static void worktile(double *w, double *padded, double *conv, double *acc,
+                     int nx, int ny, int d, int ti, int tj, int ntj, int t)
+{
+  int nyp = ny+2*d;
+  int nw  = 2*d+1;
+  int i0, j0, mi, mj, i, j, k, l;
+  double sum;
+
+  i0 = (t/ntj)*ti;
+  j0 = (t%ntj)*tj;
+
+  mi = (i0+ti > nx) ? nx-i0 : ti;
+  mj = (j0+tj > ny) ? ny-j0 : tj;
+
+  for (i=0; i < mi; i++)
+  {
+    for (j=0; j < mj; j++)
+    {
+      sum = 0.0;
+
+      for (k=0; k < nw; k++)
+      {
+        for (l=0; l < nw; l++)
+        {
+          sum = sum + w[k*nw+l]*padded[(long) (i0+i+k)*nyp + (j0+j+l)];
+        }
+      }
+
+      acc[i*tj+j] = sum;
+    }
+  }
+
+  for (i=0; i < mi; i++)
+  {
+    for (j=0; j < mj; j++)
+    {
+      conv[(long) (i0+i)*ny + (j0+j)] = acc[i*tj+j];
+    }
+  }
+}
+
+#ifdef _OPENMP
+
+/* What each stolen tile needs, with one tile buffer per thread */
+
+typedef struct
+{
+  double *w, *padded, *conv;
+  double **acc;
+  int nx, ny, d, ti, tj, ntj;
+} worksteal;
+
+static void workstealtile(void *arg, int t, int thread)
+{
+  worksteal *ws = (worksteal *) arg;
+
+  worktile(ws->w, ws->padded, ws->conv, ws->acc[thread],
+           ws->nx, ws->ny, ws->d, ws->ti, ws->tj, ws->ntj, t);
+}
+
+static void convsteal(double *w, double *padded, double *conv,
+                      int nx, int ny, int d, int ti, int tj, int ntj, int ntile)
+{
+  int nbuf = omp_get_max_threads();
+  stealstats stats[nbuf];
+  double *acc[nbuf];
+  worksteal ws;
+  int nthread, t;
+
+  for (t=0; t < nbuf; t++)
+  {
+    acc[t] = (double *) aligned_alloc(CACHELINE, (size_t) ti*tj*sizeof(double));
+
+    if (NULL == acc[t])
+    {
+      fprintf(stderr, "convworkshare: cannot allocate %d x %d tile\n", ti, tj);
+      exit(-1);
+    }
+  }
+
+  ws.w = w;
+  ws.padded = padded;
+  ws.conv = conv;
+  ws.acc = acc;
+  ws.nx = nx;
+  ws.ny = ny;
+  ws.d  = d;
+  ws.ti = ti;
+  ws.tj = tj;
+  ws.ntj = ntj;
+
+  nthread = stealrun(0, ntile, workstealtile, &ws, stats);
+
+  stealreport(stats, nthread);
+
+  for (t=0; t < nbuf; t++)
+  {
+    free(acc[t]);
+  }
+}
+
+#endif
+
+void convworkshare(int schedule, double *padded, double *conv,
+                   int nx, int ny, int d, int ti, int tj)
+{
+  double *w = getfilter(d)->w;
+  double *acc;
+
+  int nti, ntj, ntile, t;
+
+  nti = (nx+ti-1)/ti;
+  ntj = (ny+tj-1)/tj;
+  ntile = nti*ntj;
+
+#ifdef _OPENMP
+  if (schedule == SCHEDULE_STEAL)
+  {
+    convsteal(w, padded, conv, nx, ny, d, ti, tj, ntj, ntile);
+    return;
+  }
+
+  switch (schedule)
+  {
+    case SCHEDULE_DYNAMIC:
+      omp_set_schedule(omp_sched_dynamic, 1);
+      break;
+
+    case SCHEDULE_GUIDED:
+      omp_set_schedule(omp_sched_guided, 1);
+      break;
+
+    default:
+      omp_set_schedule(omp_sched_static, 0);
+  }
+#else
+  (void) schedule;
+#endif
+
+#pragma omp parallel shared(w, padded, conv, nx, ny, d, ti, tj, ntj, ntile) \
+  private(acc, t)
+  {
+    acc = (double *) aligned_alloc(CACHELINE, (size_t) ti*tj*sizeof(double));
+
+    if (NULL == acc)
+    {
+      fprintf(stderr, "convworkshare: cannot allocate %d x %d tile\n", ti, tj);
+      exit(-1);
+    }
+
+#pragma omp for schedule(runtime)
+    for (t=0; t < ntile; t++)
+    {
+      worktile(w, padded, conv, acc, nx, ny, d, ti, tj, ntj, t);
+    }
+
+    free(acc);
+  }
+}
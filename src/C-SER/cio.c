@@ -1,49 +1,759 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-#define MAXLINE 128
 #define PIXPERLINE 16
 
-char c[MAXLINE];
+/*
+ *  Both the ASCII (P2) and binary (P5) formats are supported. Binary
+ *  files have one byte per pixel if the maximum grey level is less than
+ *  256, otherwise two bytes with the most significant first. Input is
+ *  read in large blocks and ASCII integers decoded by hand, which is
+ *  many times faster than calling fscanf for every pixel. The format is
+ *  detected on input, and chosen on output by SHARPEN_FORMAT.
+ */
 
-void pgmsize(char *filename, int *nx, int *ny)
-{ 
+#define PGMBUFSIZE (1024*1024)
+
+/*
+ *  The maximum grey level of the last file opened for reading. Output
+ *  images are scaled to the same range, so a 12- or 16-bit image comes
+ *  out with the same bit depth as it went in.
+ */
+
+static int pgmthresh = 255;
+
+typedef struct pgmfile
+{
   FILE *fp;
+  char *buf;
+  size_t pos, len;
+  long base;
+  int binary, maxval, writing;
+  long k;
+} pgmfile;
+
+/*
+ *  Return the next character of the file, or EOF
+ */
+
+static int pgmfill(pgmfile *pf)
+{
+  pf->base += pf->len;
+  pf->len = fread(pf->buf, 1, PGMBUFSIZE, pf->fp);
+  pf->pos = 0;
+
+  if (0 == pf->len) return EOF;
+
+  return (unsigned char) pf->buf[pf->pos++];
+}
+
+static inline int pgmgetc(pgmfile *pf)
+{
+  if (pf->pos < pf->len) return (unsigned char) pf->buf[pf->pos++];
+
+  return pgmfill(pf);
+}
+
+/*
+ *  Read the next non-negative integer into *t, skipping white space and
+ *  comments. Returns 0 if there are no more integers.
+ */
 
-  if (NULL == (fp = fopen(filename,"r")))
+static int pgmint(pgmfile *pf, int *t)
+{
+  int ch, value;
+
+  ch = pgmgetc(pf);
+
+  while (ch == ' ' || ch == '\n' || ch == '\r' || ch == '\t' || ch == '#')
+  {
+    if (ch == '#')
+    {
+      while (ch != '\n' && ch != EOF) ch = pgmgetc(pf);
+    }
+
+    ch = pgmgetc(pf);
+  }
+
+  if (ch < '0' || ch > '9') return 0;
+
+  value = 0;
+
+  while (ch >= '0' && ch <= '9')
+  {
+    value = 10*value + (ch - '0');
+    ch = pgmgetc(pf);
+  }
+
+  *t = value;
+
+  return 1;
+}
+
+/*
+ *  Read the next pixel into *t, returning 0 at the end of the file
+ */
+
+static inline int pgmpixel(pgmfile *pf, int *t)
+{
+  int hi, lo;
+
+  if (!pf->binary) return pgmint(pf, t);
+
+  if (pf->maxval < 256)
+  {
+    lo = pgmgetc(pf);
+    if (EOF == lo) return 0;
+
+    *t = lo;
+  }
+  else
   {
-    fprintf(stderr, "pgmsize: cannot open <%s>\n", filename);
+    hi = pgmgetc(pf);
+    lo = pgmgetc(pf);
+    if (EOF == hi || EOF == lo) return 0;
+
+    *t = (hi << 8) | lo;
+  }
+
+  return 1;
+}
+
+static pgmfile *pgmalloc(void)
+{
+  pgmfile *pf;
+
+  pf = (pgmfile *) malloc(sizeof(pgmfile));
+
+  if (NULL == pf || NULL == (pf->buf = (char *) malloc(PGMBUFSIZE)))
+  {
+    fprintf(stderr, "pgmalloc: cannot allocate buffer\n");
+    exit(-1);
+  }
+
+  pf->pos = pf->len = 0;
+  pf->base = 0;
+  pf->k = 0;
+
+  return pf;
+}
+
+/*
+ *  Open a P2 or P5 file and parse its header, returning the image size
+ *  and the maximum grey level. Comments may appear anywhere in the
+ *  header. A P5 header ends with a single white space character, which
+ *  pgmint has already consumed after the maximum grey level.
+ */
+
+pgmfile *pgmopen(char *filename, int *nx, int *ny, int *maxval)
+{
+  pgmfile *pf = pgmalloc();
+  int magic;
+
+  if (NULL == (pf->fp = fopen(filename,"rb")))
+  {
+    fprintf(stderr, "pgmopen: cannot open <%s>\n", filename);
     exit(-1);
   }
 
-  fgets(c, MAXLINE, fp);
-  fgets(c, MAXLINE, fp);
+  pf->writing = 0;
+
+  if ('P' != pgmgetc(pf) || ('2' != (magic = pgmgetc(pf)) && '5' != magic))
+  {
+    fprintf(stderr, "pgmopen: <%s> is not a P2 or P5 PGM file\n", filename);
+    exit(-1);
+  }
 
-  fscanf(fp,"%d %d",nx,ny);
+  pf->binary = ('5' == magic);
 
-  fclose(fp);
+  if (!pgmint(pf, nx) || !pgmint(pf, ny) || !pgmint(pf, maxval) ||
+      *maxval < 1 || *maxval > 65535)
+  {
+    fprintf(stderr, "pgmopen: cannot read header of <%s>\n", filename);
+    exit(-1);
+  }
+
+  pf->maxval = *maxval;
+  pgmthresh  = *maxval;
+
+  return pf;
 }
 
+/*
+ *  Read the next n pixels, in file order, into pixels
+ */
 
-void pgmread(char *filename, void *vp, int nxmax, int nymax, int *nx, int *ny)
+void pgmreadpixels(pgmfile *pf, int *pixels, long n)
+{
+  long i;
+
+  for (i=0; i < n; i++)
+  {
+    if (!pgmpixel(pf, &pixels[i]))
+    {
+      fprintf(stderr, "pgmreadpixels: unexpected end of file\n");
+      exit(-1);
+    }
+  }
+}
+
+/*
+ *  Return 1 if SHARPEN_FORMAT asks for binary output, 0 for ASCII
+ */
+
+int pgmbinaryformat(void)
+{
+  char *format = getenv("SHARPEN_FORMAT");
+
+  if (NULL == format || 0 == strlen(format) || 0 == strcmp(format, "p2")) return 0;
+
+  if (0 == strcmp(format, "p5")) return 1;
+
+  fprintf(stderr, "pgmcreate: unknown value SHARPEN_FORMAT=%s, valid values are: p2 p5\n", format);
+  exit(-1);
+}
+
+/*
+ *  Create a PGM file of nx x ny pixels with maximum grey level maxval
+ *  and write its header
+ */
+
+pgmfile *pgmcreate(char *filename, int nx, int ny, int maxval)
+{
+  pgmfile *pf = pgmalloc();
+
+  if (NULL == (pf->fp = fopen(filename,"wb")))
+  {
+    fprintf(stderr, "pgmcreate: cannot create <%s>\n", filename);
+    exit(-1);
+  }
+
+  pf->writing = 1;
+  pf->binary  = pgmbinaryformat();
+  pf->maxval  = maxval;
+
+  fprintf(pf->fp, "%s\n", pf->binary ? "P5" : "P2");
+  fprintf(pf->fp, "# Written by pgmwrite\n");
+  fprintf(pf->fp, "%d %d\n", nx, ny);
+  fprintf(pf->fp, "%d\n", maxval);
+
+  return pf;
+}
+
+/*
+ *  Text of the numbers 0 to 999 as written by "%3d ", so that most grey
+ *  levels can be converted with a single four-byte copy.
+ */
+
+static char pgmtext[1000][4];
+
+static void pgmtextinit(void)
+{
+  static int done = 0;
+  int i;
+
+  if (done) return;
+
+  for (i=0; i < 1000; i++)
+  {
+    pgmtext[i][0] = i >= 100 ? '0' + i/100     : ' ';
+    pgmtext[i][1] = i >=  10 ? '0' + (i/10)%10 : ' ';
+    pgmtext[i][2] = '0' + i%10;
+    pgmtext[i][3] = ' ';
+  }
+
+  done = 1;
+}
+
+/*
+ *  Number of characters "%3d " gives for a grey level
+ */
+
+static inline int pgmwidth(int grey)
+{
+  int width = 4;
+
+  while (grey >= 1000)
+  {
+    width++;
+    grey /= 10;
+  }
+
+  return width;
+}
+
+/*
+ *  Format grey levels first to first+n-1 into text, where k is the
+ *  number of pixels already written to the file. Returns the number of
+ *  characters, and only counts them if text is NULL.
+ */
+
+static long pgmformat(int *grey, long first, long n, long k, char *text)
+{
+  long i, len;
+  int col, width;
+  char wide[16];
+
+  len = 0;
+  col = (k+first)%PIXPERLINE;
+
+  for (i=first; i < first+n; i++)
+  {
+    if (grey[i] < 1000)
+    {
+      if (NULL != text) memcpy(&text[len], pgmtext[grey[i]], 4);
+      len += 4;
+    }
+    else
+    {
+      /* Format separately so that the terminating zero cannot overwrite
+         the start of the next thread's text */
+
+      width = pgmwidth(grey[i]);
+      if (NULL != text)
+      {
+        sprintf(wide, "%3d ", grey[i]);
+        memcpy(&text[len], wide, width);
+      }
+      len += width;
+    }
+
+    if (++col == PIXPERLINE)
+    {
+      if (NULL != text) text[len] = '\n';
+      len++;
+      col = 0;
+    }
+  }
+
+  return len;
+}
+
+/*
+ *  Write the next n grey levels, in file order. ASCII output is
+ *  formatted in parallel: each thread first counts the characters
+ *  needed for its share of the pixels, the counts are added up to give
+ *  where each share starts, and then each thread writes its share into
+ *  a single buffer which goes to the file in one call.
+ */
+
+void pgmwritepixels(pgmfile *pf, int *grey, long n)
+{
+  long i, total, *start;
+  char *text;
+  int nthread;
+
+  if (pf->binary)
+  {
+    int bytes = pf->maxval < 256 ? 1 : 2;
+    unsigned char *raw = (unsigned char *) malloc(n*bytes);
+
+    if (NULL == raw)
+    {
+      fprintf(stderr, "pgmwritepixels: cannot allocate %ld bytes\n", n*bytes);
+      exit(-1);
+    }
+
+#pragma omp parallel for default(none) shared(grey, raw, n, bytes) private(i)
+    for (i=0; i < n; i++)
+    {
+      if (bytes == 1)
+      {
+        raw[i] = grey[i];
+      }
+      else
+      {
+        raw[2*i]   = grey[i] >> 8;
+        raw[2*i+1] = grey[i] & 0xff;
+      }
+    }
+
+    fwrite(raw, 1, n*bytes, pf->fp);
+    free(raw);
+
+    return;
+  }
+
+  pgmtextinit();
+
+  start = NULL;
+  text  = NULL;
+
+#pragma omp parallel shared(pf, grey, n, nthread, start, text, total)
+  {
+    long first, count;
+    int thread, t;
+
+#ifdef _OPENMP
+    thread = omp_get_thread_num();
+#else
+    thread = 0;
+#endif
+
+    /* Fewer threads than were asked for may have started */
+
+#pragma omp single
+    {
+#ifdef _OPENMP
+      nthread = omp_get_num_threads();
+#else
+      nthread = 1;
+#endif
+      start = (long *) malloc((nthread+1)*sizeof(long));
+
+      if (NULL == start)
+      {
+        fprintf(stderr, "pgmwritepixels: cannot allocate %d offsets\n", nthread+1);
+        exit(-1);
+      }
+    }
+
+    first = n*thread/nthread;
+    count = n*(thread+1)/nthread - first;
+
+    start[thread+1] = pgmformat(grey, first, count, pf->k, NULL);
+
+#pragma omp barrier
+#pragma omp single
+    {
+      start[0] = 0;
+      for (t=1; t <= nthread; t++) start[t] += start[t-1];
+
+      total = start[nthread];
+      text  = (char *) malloc(total+1);
+
+      if (NULL == text)
+      {
+        fprintf(stderr, "pgmwritepixels: cannot allocate %ld bytes\n", total);
+        exit(-1);
+      }
+    }
+
+    pgmformat(grey, first, count, pf->k, &text[start[thread]]);
+  }
+
+  fwrite(text, 1, total, pf->fp);
+
+  pf->k += n;
+
+  free(text);
+  free(start);
+}
+
+/*
+ *  Return the offset in the file of the next pixel to be read or
+ *  written, and whether the file is binary, so that the pixels of a P5
+ *  file can be transferred by other means, e.g. with MPI-IO.
+ */
+
+long pgmoffset(pgmfile *pf, int *binary)
+{
+  *binary = pf->binary;
+
+  if (pf->writing) return ftell(pf->fp);
+
+  return pf->base + pf->pos;
+}
+
+void pgmclose(pgmfile *pf)
+{
+  if (pf->writing && !pf->binary && 0 != pf->k%PIXPERLINE) fprintf(pf->fp, "\n");
+
+  fclose(pf->fp);
+  free(pf->buf);
+  free(pf);
+}
+
+/*
+ *  Map an 8-bit P5 file into memory, returning a pointer to its pixels,
+ *  in file order, and the size of the image. The mapping must be
+ *  released with pgmunmap.
+ */
+
+unsigned char *pgmmap(char *filename, int *nx, int *ny, void **map, size_t *maplen)
+{
+  pgmfile *pf;
+  struct stat st;
+  long offset;
+  int fd, maxval, binary;
+
+  pf = pgmopen(filename, nx, ny, &maxval);
+  offset = pgmoffset(pf, &binary);
+  pgmclose(pf);
+
+  if (!binary || maxval > 255)
+  {
+    fprintf(stderr, "pgmmap: <%s> is not an 8-bit P5 file\n", filename);
+    exit(-1);
+  }
+
+  if (-1 == (fd = open(filename, O_RDONLY)) || -1 == fstat(fd, &st) ||
+      st.st_size < offset + (long) *nx * *ny)
+  {
+    fprintf(stderr, "pgmmap: cannot open <%s> or it is too short\n", filename);
+    exit(-1);
+  }
+
+  *maplen = st.st_size;
+  *map = mmap(NULL, *maplen, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  close(fd);
+
+  if (MAP_FAILED == *map)
+  {
+    fprintf(stderr, "pgmmap: cannot map <%s>\n", filename);
+    exit(-1);
+  }
+
+  return (unsigned char *) *map + offset;
+}
+
+void pgmunmap(void *map, size_t maplen)
+{
+  munmap(map, maplen);
+}
+
+/*
+ *  Return the maximum grey level of the last file opened for reading,
+ *  which is also that of the files written, or 255 if none has been read.
+ */
+
+int pgmmaxval(void)
+{
+  return pgmthresh;
+}
+
+void pgmsize(char *filename, int *nx, int *ny)
 { 
-  FILE *fp;
+  int maxval;
 
-  int nxt, nyt, i, j, t;
+  pgmclose(pgmopen(filename, nx, ny, &maxval));
+}
 
-  int *pixmap = (int *) vp;
 
-  if (NULL == (fp = fopen(filename,"r")))
+/*
+ *  Store grey level t as element k of an array of int, or of unsigned
+ *  char or unsigned short if width is 1 or 2 bytes
+ */
+
+static inline void pgmstore(void *vp, int width, long k, int t)
+{
+  switch (width)
   {
-    fprintf(stderr, "pgmread: cannot open <%s>\n", filename);
+    case 1:
+      ((unsigned char *) vp)[k] = t;
+      break;
+
+    case 2:
+      ((unsigned short *) vp)[k] = t;
+      break;
+
+    default:
+      ((int *) vp)[k] = t;
+  }
+}
+
+/*
+ *  Parallel parsing of the body of a P2 file, used when there is more
+ *  than one OpenMP thread. The rest of the file is read into memory and
+ *  split into one range of bytes per thread. A number belongs to the
+ *  range in which its first digit lies, even if it runs on into the
+ *  next one. Each thread counts the numbers starting in its range, the
+ *  counts are added up to give the pixel index of each thread's first
+ *  number, and then the threads decode their ranges independently,
+ *  storing each pixel where pgmreadany would.
+ *
+ *  Returns 0, leaving the file where it was, if the body cannot be
+ *  handled this way (a serial build, one thread, a P5 file or comments
+ *  among the pixels), so the caller should fall back to the serial parser.
+ */
+
+#define PGMDIGIT(ch) ((ch) >= '0' && (ch) <= '9')
+#define PGMSPACE(ch) ((ch) == ' ' || (ch) == '\n' || (ch) == '\r' || (ch) == '\t')
+
+static int pgmreadparallel(pgmfile *pf, void *vp, int width, int fileorder, int nxt, int nyt)
+{
+#ifdef _OPENMP
+  struct stat st;
+  char *body;
+  long size, have, *first;
+  int nthread, bad, big;
+
+  if (pf->binary || omp_get_max_threads() < 2 || -1 == fstat(fileno(pf->fp), &st)) return 0;
+
+  /* Whatever is left in the buffer, then the rest of the file */
+
+  have = pf->len - pf->pos;
+  size = st.st_size - (pf->base + pf->pos);
+
+  if (size < have || NULL == (body = (char *) malloc(size))) return 0;
+
+  memcpy(body, &pf->buf[pf->pos], have);
+
+  if (size-have != (long) fread(&body[have], 1, size-have, pf->fp))
+  {
+    fprintf(stderr, "pgmread: cannot read body of file\n");
     exit(-1);
   }
 
-  fgets(c, MAXLINE, fp);
-  fgets(c, MAXLINE, fp);
+  /* Comments are rare enough to leave to the serial parser */
+
+  if (NULL != memchr(body, '#', size))
+  {
+    free(body);
+    fseek(pf->fp, pf->base + pf->len, SEEK_SET);
+    return 0;
+  }
+
+  bad = big = 0;
+  first = NULL;
+
+#pragma omp parallel shared(pf, body, size, first, nthread, vp, width, fileorder, nxt, nyt) \
+  reduction(|:bad, big)
+  {
+    long p, lo, hi, k;
+    int thread, t, value;
+    char ch;
 
-  fscanf(fp,"%d %d",nx,ny);
+    thread = omp_get_thread_num();
+
+    /* Fewer threads than were asked for may have started */
+
+#pragma omp single
+    {
+      nthread = omp_get_num_threads();
+      first = (long *) malloc((nthread+1)*sizeof(long));
+
+      if (NULL == first)
+      {
+        fprintf(stderr, "pgmread: cannot allocate %d offsets\n", nthread+1);
+        exit(-1);
+      }
+    }
+
+    lo = size*thread/nthread;
+    hi = size*(thread+1)/nthread;
+
+    /* Count the numbers starting in this range */
+
+    k = 0;
+
+    for (p=lo; p < hi; p++)
+    {
+      ch = body[p];
+
+      if (PGMDIGIT(ch))
+      {
+        if (p == 0 || !PGMDIGIT(body[p-1])) k++;
+      }
+      else if (!PGMSPACE(ch))
+      {
+        bad = 1;
+      }
+    }
+
+    first[thread+1] = k;
+
+#pragma omp barrier
+#pragma omp single
+    {
+      first[0] = 0;
+      for (t=1; t <= nthread; t++) first[t] += first[t-1];
+    }
+
+    /* Decode them, skipping any digits that belong to the last range */
+
+    k = first[thread];
+    p = lo;
+
+    if (p > 0)
+    {
+      while (p < hi && PGMDIGIT(body[p]) && PGMDIGIT(body[p-1])) p++;
+    }
+
+    while (p < hi)
+    {
+      if (!PGMDIGIT(body[p]))
+      {
+        p++;
+        continue;
+      }
+
+      value = 0;
+
+      while (p < size && PGMDIGIT(body[p]))
+      {
+        value = 10*value + (body[p] - '0');
+        p++;
+      }
+
+      if (k < (long) nxt*nyt)
+      {
+        if (value > pf->maxval) big = 1;
+        pgmstore(vp, width, fileorder ? k : (nyt-k/nxt-1)+(long) nyt*(k%nxt), value);
+      }
+
+      k++;
+    }
+  }
+
+  free(body);
+
+  if (bad)
+  {
+    fprintf(stderr, "pgmread: unexpected character in body of file\n");
+    exit(-1);
+  }
+
+  if (big)
+  {
+    fprintf(stderr, "pgmread: grey level larger than maximum of %d\n", pf->maxval);
+    exit(-1);
+  }
+
+  if (first[nthread] < (long) nxt*nyt)
+  {
+    fprintf(stderr, "pgmread: unexpected end of file\n");
+    exit(-1);
+  }
+
+  free(first);
+
+  return 1;
+#else
+  (void) pf; (void) vp; (void) width; (void) fileorder; (void) nxt; (void) nyt;
+
+  return 0;
+#endif
+}
+
+/*
+ *  Read the pixels into an array of int, or of unsigned char or
+ *  unsigned short if width is 1 or 2 bytes, in which case the maximum
+ *  grey level must fit. The array is x[nx][ny] with j counting up from
+ *  the bottom row, unless fileorder is set, in which case it is stored
+ *  in the same order as the file, i.e. as y[ny][nx] with the top row
+ *  first, and is read sequentially.
+ */
+
+static void pgmreadany(char *filename, void *vp, int width, int fileorder,
+                       int nxmax, int nymax, int *nx, int *ny)
+{ 
+  pgmfile *pf;
+
+  int nxt, nyt, i, j, t, maxval;
+
+  pf = pgmopen(filename, nx, ny, &maxval);
 
   nxt = *nx;
   nyt = *ny;
@@ -56,51 +766,120 @@ void pgmread(char *filename, void *vp, int nxmax, int nymax, int *nx, int *ny)
     exit(-1);
   }
 
-  /*
-   * Skip the threshold parameter
-   */
+  if (width == 1 && maxval > 255)
+  {
+    fprintf(stderr, "pgmread: maximum grey level %d does not fit in a byte\n", maxval);
+    exit(-1);
+  }
 
-  fscanf(fp,"%d", &t);
+  if (pgmreadparallel(pf, vp, width, fileorder, nxt, nyt))
+  {
+    pgmclose(pf);
+    return;
+  }
 
   /*
    *  Must cope with the fact that the storage order of the data file
    *  is not the same as the storage of a C array, hence the pointer
-   *  arithmetic to access x[i][j].
+   *  arithmetic to access x[i][j]. In file order it is just the next
+   *  element.
    */
 
   for (j=0; j<nyt; j++)
   {
     for (i=0; i<nxt; i++)
     {
-      fscanf(fp,"%d", &t);
-      pixmap[(nyt-j-1)+nyt*i] = t;
+      if (!pgmpixel(pf, &t))
+      {
+        fprintf(stderr, "pgmread: unexpected end of file\n");
+        exit(-1);
+      }
+
+      if (t > maxval)
+      {
+        fprintf(stderr, "pgmread: grey level %d larger than maximum of %d\n", t, maxval);
+        exit(-1);
+      }
+
+      pgmstore(vp, width, fileorder ? (long) nxt*j+i : (nyt-j-1)+(long) nyt*i, t);
     }
   }
 
-  fclose(fp);
+  pgmclose(pf);
+}
+
+void pgmread(char *filename, void *vp, int nxmax, int nymax, int *nx, int *ny)
+{
+  pgmreadany(filename, vp, sizeof(int), 0, nxmax, nymax, nx, ny);
+}
+
+void pgmreadbytes(char *filename, void *vp, int nxmax, int nymax, int *nx, int *ny)
+{
+  pgmreadany(filename, vp, 1, 0, nxmax, nymax, nx, ny);
+}
+
+void pgmreadshorts(char *filename, void *vp, int nxmax, int nymax, int *nx, int *ny)
+{
+  pgmreadany(filename, vp, 2, 0, nxmax, nymax, nx, ny);
+}
+
+/*
+ *  Read the image in file order into an array whose elements are width
+ *  bytes long: unsigned char, unsigned short or int
+ */
+
+void pgmreadrows(char *filename, void *vp, int width, int nxmax, int nymax, int *nx, int *ny)
+{
+  pgmreadany(filename, vp, width, 1, nxmax, nymax, nx, ny);
+}
+
+/*
+ *  Scale the value appropriately so it lies between 0 and thresh, given
+ *  the max and min absolute values of the whole image
+ */
+
+int pgmgrey(double tmp, double xmin, double xmax, double thresh)
+{
+  if (xmin < 0 || xmax > thresh)
+  {
+    tmp = (int) ((thresh*((fabs(tmp-xmin))/(xmax-xmin))) + 0.5);
+  }
+  else
+  {
+    tmp = (int) (fabs(tmp) + 0.5);
+  }
+
+  return tmp;
 }
 
 /*
  *  Routine to write a PGM image file from a 2D floating point array
  *  x[nx][ny]. Because of the way C handles (or fails to handle!)
  *  multi-dimensional arrays we have to cast the pointer to void.
+ *  If fileorder is set the array is instead stored row by row in the
+ *  same order as the file, i.e. as y[ny][nx] with the top row first.
+ *  The grey levels run up to the maximum of the input image.
  */
 
-
-void pgmwrite(char *filename, void *vx, int nx, int ny)
+static void pgmwriteany(char *filename, void *vx, int nx, int ny, int fileorder)
 {
-  FILE *fp;
+  pgmfile *pf;
 
-  int i, j, k, grey;
+  long i, j, n;
+  int *grey, *out, scaled;
 
-  double xmin, xmax, tmp;
-  double thresh = 255.0;
+  double xmin, xmax, *xrow;
+  double thresh = pgmthresh;
 
   double *x = (double *) vx;
 
-  if (NULL == (fp = fopen(filename,"w")))
+  n = (long) nx*ny;
+
+  grey = (int *) malloc(n*sizeof(int));
+
+  if (NULL == grey)
   {
-    fprintf(stderr, "pgmwrite: cannot create <%s>\n", filename);
+    fprintf(stderr, "pgmwrite: cannot allocate %d x %d grey levels\n", nx, ny);
     exit(-1);
   }
 
@@ -111,58 +890,79 @@ void pgmwrite(char *filename, void *vx, int nx, int ny)
   xmin = fabs(x[0]);
   xmax = fabs(x[0]);
 
-  for (i=0; i < nx*ny; i++)
+#pragma omp parallel for default(none) shared(x, n) private(i) reduction(min:xmin) reduction(max:xmax)
+  for (i=0; i < n; i++)
   {
     if (fabs(x[i]) < xmin) xmin = fabs(x[i]);
     if (fabs(x[i]) > xmax) xmax = fabs(x[i]);
   }
 
-  fprintf(fp, "P2\n");
-  fprintf(fp, "# Written by pgmwrite\n");
-  fprintf(fp, "%d %d\n", nx, ny);
-  fprintf(fp, "%d\n", (int) thresh);
+  /*
+   *  Scale the values to grey levels in file order, the top row first.
+   *  Each row is first copied out of the array, so that the scaling, as
+   *  in pgmgrey but with the choice of scaling taken out of the loop,
+   *  works on contiguous data and can be vectorised.
+   */
 
-  k = 0;
+  scaled = (xmin < 0 || xmax > thresh);
 
-  for (j=ny-1; j >=0 ; j--)
+#pragma omp parallel shared(x, grey, nx, ny, xmin, xmax, thresh, scaled, fileorder) private(i, j, xrow, out)
   {
-    for (i=0; i < nx; i++)
+    xrow = (double *) malloc(nx*sizeof(double));
+
+    if (NULL == xrow)
+    {
+      fprintf(stderr, "pgmwrite: cannot allocate row of %d pixels\n", nx);
+      exit(-1);
+    }
+
+#pragma omp for
+    for (j=0; j < ny; j++)
     {
       /*
-       *  Access the value of x[i][j]
+       *  Access the values of x[i][ny-1-j]
        */
 
-      tmp = x[j+ny*i];
+      for (i=0; i < nx; i++)
+      {
+        xrow[i] = fileorder ? x[j*nx+i] : x[(ny-1-j)+ny*i];
+      }
 
-      /*
-       *  Scale the value appropriately so it lies between 0 and thresh
-       */
+      out = &grey[j*nx];
 
-      if (xmin < 0 || xmax > thresh)
+      if (scaled)
       {
-        tmp = (int) ((thresh*((fabs(tmp-xmin))/(xmax-xmin))) + 0.5);
+        for (i=0; i < nx; i++)
+        {
+          out[i] = (int) ((thresh*((fabs(xrow[i]-xmin))/(xmax-xmin))) + 0.5);
+        }
       }
       else
       {
-        tmp = (int) (fabs(tmp) + 0.5);
+        for (i=0; i < nx; i++)
+        {
+          out[i] = (int) (fabs(xrow[i]) + 0.5);
+        }
       }
+    }
 
-      grey = tmp;
+    free(xrow);
+  }
 
-      /*
-       *  Increase the contrast by boosting the lower values?
-       */
-     
-      /*      grey = thresh * sqrt(tmp/thresh); */
+  pf = pgmcreate(filename, nx, ny, (int) thresh);
 
-      fprintf(fp, "%3d ", grey);
+  pgmwritepixels(pf, grey, n);
 
-      if (0 == (k+1)%PIXPERLINE) fprintf(fp, "\n");
+  pgmclose(pf);
+  free(grey);
+}
 
-      k++;
-    }
-  }
+void pgmwrite(char *filename, void *vx, int nx, int ny)
+{
+  pgmwriteany(filename, vx, nx, ny, 0);
+}
 
-  if (0 != k%PIXPERLINE) fprintf(fp, "\n");
-  fclose(fp);
+void pgmwriterows(char *filename, void *vx, int nx, int ny)
+{
+  pgmwriteany(filename, vx, nx, ny, 1);
 }
@@ -0,0 +1,143 @@
+/*  Alternative convolution engines.
+ *
+ *  All engines compute the same quantity as the loop in dosharpen,
+ *
+ *    conv[i][j] = sum_{k,l=-d..d} filter(d,k,l) * padded[i+d+k][j+d+l]
+ *
+ *  for 0 <= i < nx, 0 <= j < ny, where padded is the fuzzy image with a
+ *  border of d zeros, stored contiguously as an (nx+2d) x (ny+2d) array,
+ *  and conv is stored contiguously as an nx x ny array. Any OpenMP
+ *  parallelism is inside the engines so the same code is used by both
+ *  the serial and threaded programs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "sharpen.h"
+
+/*
+ *  Straightforward direct evaluation, as in dosharpen, used as the
+ *  reference when checking the other engines.
+ */
+
+static void convdirect(double *padded, double *conv, int nx, int ny, int d)
+{
+  int i, j, k, l;
+  int nyp = ny+2*d;
+  int nw  = 2*d+1;
+  double *w = getfilter(d)->w;
+  double sum;
+
+#pragma omp parallel for default(none) shared(padded, conv, nx, ny, nyp, nw, d, w) private(i, j, k, l, sum)
+  for (i=0; i < nx; i++)
+  {
+    for (j=0; j < ny; j++)
+    {
+      sum = 0.0;
+
+      for (k=-d; k <= d; k++)
+      {
+        for (l=-d; l <= d; l++)
+        {
+          sum = sum + w[(k+d)*nw+(l+d)]*padded[(long) (i+d+k)*nyp+(j+d+l)];
+        }
+      }
+
+      conv[(long) i*ny+j] = sum;
+    }
+  }
+}
+
+/*
+ *  Resolve the "auto" engine to whichever of the direct loop and the FFT
+ *  is expected to be faster for this problem size.
+ */
+
+int selectengine(int engine, int nx, int ny, int d)
+{
+  if (engine != ENGINE_AUTO) return engine;
+
+  return fftcrossover(nx, ny, d) ? ENGINE_FFT : ENGINE_DIRECT;
+}
+
+void convolve(int engine, double *padded, double *conv, int nx, int ny, int d)
+{
+  switch (selectengine(engine, nx, ny, d))
+  {
+    case ENGINE_DIRECT:
+      convdirect(padded, conv, nx, ny, d);
+      break;
+
+    case ENGINE_SEPARABLE:
+      convseparable(padded, conv, nx, ny, d);
+      break;
+
+    case ENGINE_FFT:
+      convfft(padded, conv, nx, ny, d);
+      break;
+
+    case ENGINE_SIMD:
+      convsimd(padded, conv, nx, ny, d);
+      break;
+
+    case ENGINE_TILED:
+      convtiled(padded, conv, nx, ny, d);
+      break;
+
+    case ENGINE_IIR:
+      conviir(padded, conv, nx, ny, d);
+      break;
+
+    case ENGINE_FIXED:
+      convfixed(padded, conv, nx, ny, d);
+      break;
+
+    default:
+      fprintf(stderr, "convolve: unknown engine %d\n", engine);
+      exit(-1);
+  }
+}
+
+/*
+ *  Compare a convolution against the direct calculation and report the
+ *  largest difference, both absolute and relative to the largest
+ *  absolute value of the convolution itself. The sharpened image is
+ *  the fuzzy image minus factor times the convolution, so also report
+ *  how many grey levels of the sharpened image this corresponds to.
+ */
+
+void checkconvolution(double *padded, double *conv, int nx, int ny, int d, double factor)
+{
+  double *ref;
+  double diff, maxdiff, maxref;
+  long i;
+
+  ref = (double *) malloc((long) nx*ny*sizeof(double));
+
+  if (NULL == ref)
+  {
+    fprintf(stderr, "checkconvolution: cannot allocate %d x %d reference\n", nx, ny);
+    exit(-1);
+  }
+
+  convdirect(padded, ref, nx, ny, d);
+
+  maxdiff = 0.0;
+  maxref  = 0.0;
+
+  for (i=0; i < (long) nx*ny; i++)
+  {
+    diff = fabs(conv[i]-ref[i]);
+
+    if (diff > maxdiff) maxdiff = diff;
+    if (fabs(ref[i]) > maxref) maxref = fabs(ref[i]);
+  }
+
+  printf("Maximum difference from direct convolution is %e (relative %e)\n",
+         maxdiff, maxref > 0.0 ? maxdiff/maxref : 0.0);
+  printf("This changes the sharpened image by at most %e grey levels\n", factor*maxdiff);
+  printf("\n");
+
+  free(ref);
+}
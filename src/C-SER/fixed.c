@@ -0,0 +1,142 @@
+/*  Direct convolution specialised for particular filter ranges.
+ *
+ *  The loop is the direct one from dosharpen, but for each of the
+ *  commonly used ranges d = 2, 4, 8 and 16 it is compiled separately
+ *  with d a constant. The tap loops then have fixed trip counts and the
+ *  coefficients form a fixed-size table, so an optimising compiler
+ *  (e.g. -O3) can unroll the loop over l completely and vectorise the
+ *  loop over j that surrounds it. Any other range uses the same code
+ *  with d as a variable.
+ *
+ *  C has no compile-time evaluation of exp(), so the coefficient tables
+ *  are still computed once at run time by getfilter(). Each output
+ *  pixel accumulates its taps in the same order as the loop in
+ *  dosharpen, so the result is identical unless the compiler is allowed
+ *  to contract the multiply-adds (e.g. gcc with -march=native).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "sharpen.h"
+
+/*
+ *  One output row. Declared always_inline so that each call below with
+ *  a constant d is compiled as a separate, specialised copy.
+ */
+
+static inline __attribute__((always_inline))
+void rowfixed(const double *restrict w, const double *restrict padded,
+              double *restrict conv, int ny, int d, int i)
+{
+  int j, k, l;
+  int nyp = ny+2*d;
+  int nw  = 2*d+1;
+  const double *in, *wk;
+  double sum;
+
+  for (j=0; j < ny; j++)
+  {
+    conv[(long) i*ny+j] = 0.0;
+  }
+
+  for (k=0; k < nw; k++)
+  {
+    in = &padded[(long) (i+k)*nyp];
+    wk = &w[k*nw];
+
+    for (j=0; j < ny; j++)
+    {
+      sum = conv[(long) i*ny+j];
+
+      for (l=0; l < nw; l++)
+      {
+        sum = sum + wk[l]*in[j+l];
+      }
+
+      conv[(long) i*ny+j] = sum;
+    }
+  }
+}
+
+/*
+ *  The specialised instantiations, one for each range that is also
+ *  listed in fixedspecialised(), plus the generic fallback. Each opens
+ *  its own parallel region, so that the body outlined for the threads
+ *  is compiled with D a constant.
+ */
+
+#define FIXEDKERNEL(D) \
+static void convfixed##D(const double *w, const double *padded, double *conv, int nx, int ny) \
+{ \
+  int i; \
+\
+  _Pragma("omp parallel for default(none) shared(w, padded, conv, nx, ny) private(i)") \
+  for (i=0; i < nx; i++) \
+  { \
+    rowfixed(w, padded, conv, ny, D, i); \
+  } \
+}
+
+FIXEDKERNEL(2)
+FIXEDKERNEL(4)
+FIXEDKERNEL(8)
+FIXEDKERNEL(16)
+
+static void convgeneric(const double *w, const double *padded, double *conv,
+                        int nx, int ny, int d)
+{
+  int i;
+
+#pragma omp parallel for default(none) shared(w, padded, conv, nx, ny, d) private(i)
+  for (i=0; i < nx; i++)
+  {
+    rowfixed(w, padded, conv, ny, d, i);
+  }
+}
+
+/*
+ *  Return 1 if there is a kernel specialised for range d, or 0 if the
+ *  generic one will be used.
+ */
+
+int fixedspecialised(int d)
+{
+  switch (d)
+  {
+    case 2:
+    case 4:
+    case 8:
+    case 16:
+      return 1;
+
+    default:
+      return 0;
+  }
+}
+
+void convfixed(double *padded, double *conv, int nx, int ny, int d)
+{
+  double *w = getfilter(d)->w;
+
+  switch (d)
+  {
+    case 2:
+      convfixed2(w, padded, conv, nx, ny);
+      break;
+
+    case 4:
+      convfixed4(w, padded, conv, nx, ny);
+      break;
+
+    case 8:
+      convfixed8(w, padded, conv, nx, ny);
+      break;
+
+    case 16:
+      convfixed16(w, padded, conv, nx, ny);
+      break;
+
+    default:
+      convgeneric(w, padded, conv, nx, ny, d);
+  }
+}
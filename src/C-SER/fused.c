@@ -0,0 +1,358 @@
+/*  Fused sharpening pipeline.
+ *
+ *  The standard calculation pads the fuzzy image, convolves it, forms
+ *  the sharp image as fuzzy - factor*convolution and then crops it,
+ *  each step making a pass over a separate full-sized array. Since
+ *
+ *    sharp[i][j] = sum_{k,l} (delta(k,l) - factor*filter(d,k,l)) * fuzzy[i+k][j+l]
+ *
+ *  the whole calculation is a single convolution with a modified
+ *  filter. Only the cropped pixels, d <= i < nx-d and d <= j < ny-d,
+ *  are computed, so every tap falls inside the image and the padding is
+ *  never needed: the input is read directly from the integer image and
+ *  converted as it is used, and the results go straight into the
+ *  cropped output array.
+ *
+ *  With SHARPEN_OUTPUT=full the border pixels are also computed, using
+ *  whichever boundary treatment was chosen (see boundary.c).
+ *
+ *  The input can be held as int, as bytes for 8-bit images or as
+ *  unsigned shorts for images of up to 16 bits. In the last case the
+ *  sums are accumulated in single precision, which holds 16-bit grey
+ *  levels exactly and doubles the width of the vector arithmetic; the
+ *  rounding error is far below one output grey level.
+ *
+ *  The sum is rounded differently from the standard calculation, so an
+ *  output pixel could in principle differ by one grey level, although
+ *  for the test image the output file is identical.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "sharpen.h"
+
+/*
+ *  The modified filter delta(k,l) - factor*filter(d,k,l), which the
+ *  caller must free.
+ */
+
+static double *fusedfilter(int d, double factor)
+{
+  int nw = 2*d+1;
+  int i;
+
+  double *w = getfilter(d)->w;
+  double *ws;
+
+  ws = (double *) malloc(nw*nw*sizeof(double));
+
+  if (NULL == ws)
+  {
+    fprintf(stderr, "fusedfilter: cannot allocate %d x %d filter\n", nw, nw);
+    exit(-1);
+  }
+
+  for (i=0; i < nw*nw; i++)
+  {
+    ws[i] = -factor*w[i];
+  }
+
+  ws[d*nw+d] += 1.0;
+
+  return ws;
+}
+
+/*
+ *  Output row i of the cropped image, from an input image with ny
+ *  pixels per row stored as int or as bytes. The pixels are converted
+ *  to double as they are loaded.
+ */
+
+static void rowint(double *ws, int *fuzzy, double *out, int ny, int d, int i)
+{
+  int nw  = 2*d+1;
+  int nys = ny-2*d;
+  int j, k, l;
+  int *in;
+  double *wk, sum;
+
+  for (j=0; j < nys; j++)
+  {
+    out[j] = 0.0;
+  }
+
+  for (k=0; k < nw; k++)
+  {
+    in = &fuzzy[(long) (i+k)*ny];
+    wk = &ws[k*nw];
+
+    for (j=0; j < nys; j++)
+    {
+      sum = out[j];
+
+      for (l=0; l < nw; l++)
+      {
+        sum = sum + wk[l]*(double) in[j+l];
+      }
+
+      out[j] = sum;
+    }
+  }
+}
+
+static void rowbyte(double *ws, unsigned char *fuzzy, double *out, int ny, int d, int i)
+{
+  int nw  = 2*d+1;
+  int nys = ny-2*d;
+  int j, k, l;
+  unsigned char *in;
+  double *wk, sum;
+
+  for (j=0; j < nys; j++)
+  {
+    out[j] = 0.0;
+  }
+
+  for (k=0; k < nw; k++)
+  {
+    in = &fuzzy[(long) (i+k)*ny];
+    wk = &ws[k*nw];
+
+    for (j=0; j < nys; j++)
+    {
+      sum = out[j];
+
+      for (l=0; l < nw; l++)
+      {
+        sum = sum + wk[l]*(double) in[j+l];
+      }
+
+      out[j] = sum;
+    }
+  }
+}
+
+/*
+ *  For unsigned shorts the filter is held in single precision and each
+ *  output pixel summed in a single precision register.
+ */
+
+static void rowshort(float *ws, unsigned short *fuzzy, double *out, int ny, int d, int i)
+{
+  int nw  = 2*d+1;
+  int nys = ny-2*d;
+  int j, k, l;
+  unsigned short *in;
+  float *wk, sum;
+
+  for (j=0; j < nys; j++)
+  {
+    sum = 0.0f;
+
+    for (k=0; k < nw; k++)
+    {
+      in = &fuzzy[(long) (i+k)*ny+j];
+      wk = &ws[k*nw];
+
+      for (l=0; l < nw; l++)
+      {
+        sum = sum + wk[l]*(float) in[l];
+      }
+    }
+
+    out[j] = sum;
+  }
+}
+
+static float *fusedfloat(double *ws, int d)
+{
+  int nw = 2*d+1;
+  int i;
+  float *wsf;
+
+  wsf = (float *) malloc(nw*nw*sizeof(float));
+
+  if (NULL == wsf)
+  {
+    fprintf(stderr, "fusedfloat: cannot allocate %d x %d filter\n", nw, nw);
+    exit(-1);
+  }
+
+  for (i=0; i < nw*nw; i++)
+  {
+    wsf[i] = (float) ws[i];
+  }
+
+  return wsf;
+}
+
+/*
+ *  fuzzy is the nx x ny input image and sharp the (nx-2d) x (ny-2d)
+ *  output image, both stored contiguously.
+ */
+
+void sharpenfused(int *fuzzy, double *sharp, int nx, int ny, int d, double factor)
+{
+  int nxs = nx-2*d;
+  int nys = ny-2*d;
+  int i;
+
+  double *ws = fusedfilter(d, factor);
+
+#pragma omp parallel for default(none) shared(fuzzy, sharp, ws, nxs, nys, ny, d) private(i)
+  for (i=0; i < nxs; i++)
+  {
+    rowint(ws, fuzzy, &sharp[(long) i*nys], ny, d, i);
+  }
+
+  free(ws);
+}
+
+/*
+ *  The same for an image stored as one byte per pixel, which needs an
+ *  eighth of the memory of a double array. Since only the cropped
+ *  output is computed the zero padding is implicit: no tap ever falls
+ *  outside the image.
+ */
+
+void sharpenfusedbytes(unsigned char *fuzzy, double *sharp, int nx, int ny, int d, double factor)
+{
+  int nxs = nx-2*d;
+  int nys = ny-2*d;
+  int i;
+
+  double *ws = fusedfilter(d, factor);
+
+#pragma omp parallel for default(none) shared(fuzzy, sharp, ws, nxs, nys, ny, d) private(i)
+  for (i=0; i < nxs; i++)
+  {
+    rowbyte(ws, fuzzy, &sharp[(long) i*nys], ny, d, i);
+  }
+
+  free(ws);
+}
+
+/*
+ *  The same for an image of up to 16 bits stored as unsigned shorts,
+ *  summing in single precision.
+ */
+
+void sharpenfusedshorts(unsigned short *fuzzy, double *sharp, int nx, int ny, int d, double factor)
+{
+  int nxs = nx-2*d;
+  int nys = ny-2*d;
+  int i;
+
+  double *ws = fusedfilter(d, factor);
+  float *wsf = fusedfloat(ws, d);
+
+#pragma omp parallel for default(none) shared(fuzzy, sharp, wsf, nxs, nys, ny, d) private(i)
+  for (i=0; i < nxs; i++)
+  {
+    rowshort(wsf, fuzzy, &sharp[(long) i*nys], ny, d, i);
+  }
+
+  free(wsf);
+  free(ws);
+}
+
+/*
+ *  Pixel k of the input image, stored as int unless storage says
+ *  otherwise
+ */
+
+static inline double fusedpixel(void *fuzzy, int storage, long k)
+{
+  switch (storage)
+  {
+    case STORAGE_UINT8:
+      return ((unsigned char *) fuzzy)[k];
+
+    case STORAGE_UINT16:
+      return ((unsigned short *) fuzzy)[k];
+
+    default:
+      return ((int *) fuzzy)[k];
+  }
+}
+
+/*
+ *  Sharpen the whole nx x ny image, including the pixels within d of
+ *  the edges, into the nx x ny array sharp. The input image fuzzy is
+ *  stored as int, or as bytes or unsigned shorts for STORAGE_UINT8 and
+ *  STORAGE_UINT16. The interior uses the row kernels above; only the
+ *  border pixels, whose filter extends outside the image, go through
+ *  the slower loop that applies the boundary treatment.
+ */
+
+void sharpenfusedfull(void *fuzzy, int storage, double *sharp,
+                      int nx, int ny, int d, double factor, int boundary)
+{
+  int nw = 2*d+1;
+  int i, j, k, l, bi, bj;
+
+  double *ws = fusedfilter(d, factor);
+  double sum, pixel, *out;
+
+  float *wsf = fusedfloat(ws, d);
+
+#pragma omp parallel default(none) shared(fuzzy, storage, sharp, ws, wsf, nx, ny, nw, d, boundary) \
+  private(i, j, k, l, bi, bj, sum, pixel, out)
+  {
+#pragma omp for
+    for (i=d; i < nx-d; i++)
+    {
+      out = &sharp[(long) i*ny+d];
+
+      switch (storage)
+      {
+        case STORAGE_UINT8:
+          rowbyte(ws, (unsigned char *) fuzzy, out, ny, d, i-d);
+          break;
+
+        case STORAGE_UINT16:
+          rowshort(wsf, (unsigned short *) fuzzy, out, ny, d, i-d);
+          break;
+
+        default:
+          rowint(ws, (int *) fuzzy, out, ny, d, i-d);
+      }
+    }
+
+#pragma omp for
+    for (i=0; i < nx; i++)
+    {
+      for (j=0; j < ny; j++)
+      {
+        /* Skip straight over the interior of the row */
+
+        if (i >= d && i < nx-d && j == d) j = ny-d;
+
+        sum = 0.0;
+
+        for (k=-d; k <= d; k++)
+        {
+          bi = boundaryindex(boundary, i+k, nx);
+
+          if (bi < 0) continue;
+
+          for (l=-d; l <= d; l++)
+          {
+            bj = boundaryindex(boundary, j+l, ny);
+
+            if (bj < 0) continue;
+
+            pixel = fusedpixel(fuzzy, storage, (long) bi*ny+bj);
+
+            sum = sum + ws[(k+d)*nw+(l+d)]*pixel;
+          }
+        }
+
+        sharp[(long) i*ny+j] = sum;
+      }
+    }
+  }
+
+  free(wsf);
+  free(ws);
+}
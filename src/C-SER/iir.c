@@ -0,0 +1,485 @@
+/*  Recursive (IIR) convolution engine.
+ *
+ *  With G the normalised Gaussian of width sigma, the sharpening filter
+ *  can be written as
+ *
+ *    f(x,y) = filter0 * (1 - r^2/(2 sigma^2)) * exp(-r^2/(2 sigma^2))
+ *           = -filter0 * pi * sigma^4 * ( G''(x) G(y) + G(x) G''(y) )
+ *
+ *  so the convolution can be done with one-dimensional passes: the
+ *  Gaussian and its second derivative along j for every row, then the
+ *  same two filters along i. Each one-dimensional filter uses Deriche's
+ *  fourth-order recursive approximation (R. Deriche, "Recursively
+ *  implementing the Gaussian and its derivatives", INRIA RR-1893, 1993):
+ *  a causal pass and an anti-causal pass, both applied to the input and
+ *  then added, whose cost per pixel does not depend on sigma. Both
+ *  passes only ever look at input on one side, so the zero border of
+ *  the image is treated exactly. The passes along i sweep whole rows at
+ *  a time so that all memory accesses are sequential.
+ *
+ *  Unlike the direct loop the recursive filters are not truncated at a
+ *  range of d, and the standard filter is far from zero at the edge of
+ *  the (2d+1) x (2d+1) square: for d = 8 the missing values sum to 46
+ *  against a central value of -40. This is corrected by subtracting the
+ *  missing sum times a Gaussian blur whose width matches the second
+ *  moment of the missing values, done with two more recursive passes.
+ *
+ *  The result is still an approximation to the direct sum. For the test
+ *  image the largest difference is 1-3% of the largest convolution
+ *  value, or up to about 20 grey levels in the sharpened image, for
+ *  ranges from 2 to 32. SHARPEN_CHECK=1 reports the difference. At a
+ *  range of 1 the Gaussian is too narrow for Deriche's approximation,
+ *  so getoptions does not allow it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <complex.h>
+#include "sharpen.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/*
+ *  Coefficients of one filter: the causal pass is
+ *
+ *    y+[n] = sum_{k=0..3} np[k] x[n-k] - sum_{k=1..4} dd[k] y+[n-k]
+ *
+ *  and the anti-causal pass
+ *
+ *    y-[n] = sum_{k=1..4} nm[k] x[n+k] - sum_{k=1..4} dd[k] y-[n+k]
+ */
+
+typedef struct
+{
+  double np[4], nm[5], dd[5];
+} deriche;
+
+/*
+ *  Deriche's parameters for a unit width: the response for x >= 0 is
+ *  (a0 cos(w0 x) + a1 sin(w0 x)) exp(-b0 x) + (c0 cos(w1 x) + c1 sin(w1 x)) exp(-b1 x)
+ */
+
+static double gausspar[8] = { 1.680,  3.735, 1.783, 1.723, 0.6318, 1.997, -0.6803, -0.2598};
+static double d2par[8]    = {-1.331,  3.661, 1.240, 1.314, 0.7480, 2.166,  0.3225, -1.738 };
+
+/*
+ *  Build the recursive filter for an even response of width sigma by
+ *  writing the response as a sum over four complex poles.
+ */
+
+static void derichecoeffs(double *par, double sigma, deriche *f)
+{
+  double a0 = par[0], a1 = par[1], b0 = par[2], b1 = par[3];
+  double w0 = par[4], w1 = par[5], c0 = par[6], c1 = par[7];
+
+  double complex pole[4], amp[4], poly[5], num[4], term[4];
+  int p, q, k;
+
+  pole[0] = cexp((-b0 + I*w0)/sigma);
+  pole[1] = conj(pole[0]);
+  pole[2] = cexp((-b1 + I*w1)/sigma);
+  pole[3] = conj(pole[2]);
+
+  amp[0] = 0.5*(a0 - I*a1);
+  amp[1] = conj(amp[0]);
+  amp[2] = 0.5*(c0 - I*c1);
+  amp[3] = conj(amp[2]);
+
+  /* Denominator: product of (1 - pole u) over all poles */
+
+  poly[0] = 1.0;
+  for (k=1; k < 5; k++) poly[k] = 0.0;
+
+  for (p=0; p < 4; p++)
+  {
+    for (k=p+1; k > 0; k--) poly[k] = poly[k] - pole[p]*poly[k-1];
+  }
+
+  /* Numerator: sum over poles of amp times the other three factors */
+
+  for (k=0; k < 4; k++) num[k] = 0.0;
+
+  for (p=0; p < 4; p++)
+  {
+    term[0] = amp[p];
+    for (k=1; k < 4; k++) term[k] = 0.0;
+
+    for (q=0; q < 4; q++)
+    {
+      if (q == p) continue;
+      for (k=3; k > 0; k--) term[k] = term[k] - pole[q]*term[k-1];
+    }
+
+    for (k=0; k < 4; k++) num[k] = num[k] + term[k];
+  }
+
+  for (k=0; k < 4; k++) f->np[k] = creal(num[k]);
+  for (k=0; k < 5; k++) f->dd[k] = creal(poly[k]);
+
+  /* Anti-causal part is the mirror image, without the n = 0 term */
+
+  f->nm[0] = 0.0;
+  for (k=1; k < 4; k++) f->nm[k] = f->np[k] - f->np[0]*f->dd[k];
+  f->nm[4] = -f->np[0]*f->dd[4];
+}
+
+static void scalecoeffs(deriche *f, double s)
+{
+  int k;
+
+  for (k=0; k < 4; k++) f->np[k] = s*f->np[k];
+  for (k=0; k < 5; k++) f->nm[k] = s*f->nm[k];
+}
+
+/*
+ *  Filter the n values x[0], x[stride], ... into y, with zeros beyond
+ *  both ends.
+ */
+
+static void dericheline(double *x, double *y, int n, deriche *f)
+{
+  double xm[4] = {0.0, 0.0, 0.0, 0.0};
+  double ym[4] = {0.0, 0.0, 0.0, 0.0};
+  double yn;
+  int i;
+
+  for (i=0; i < n; i++)
+  {
+    yn = f->np[0]*x[i] + f->np[1]*xm[0] + f->np[2]*xm[1] + f->np[3]*xm[2]
+       - f->dd[1]*ym[0] - f->dd[2]*ym[1] - f->dd[3]*ym[2] - f->dd[4]*ym[3];
+
+    xm[2] = xm[1]; xm[1] = xm[0]; xm[0] = x[i];
+    ym[3] = ym[2]; ym[2] = ym[1]; ym[1] = ym[0]; ym[0] = yn;
+
+    y[i] = yn;
+  }
+
+  for (i=0; i < 4; i++)
+  {
+    xm[i] = 0.0;
+    ym[i] = 0.0;
+  }
+
+  for (i=n-1; i >= 0; i--)
+  {
+    yn = f->nm[1]*xm[0] + f->nm[2]*xm[1] + f->nm[3]*xm[2] + f->nm[4]*xm[3]
+       - f->dd[1]*ym[0] - f->dd[2]*ym[1] - f->dd[3]*ym[2] - f->dd[4]*ym[3];
+
+    xm[3] = xm[2]; xm[2] = xm[1]; xm[1] = xm[0]; xm[0] = x[i];
+    ym[3] = ym[2]; ym[2] = ym[1]; ym[1] = ym[0]; ym[0] = yn;
+
+    y[i] = y[i] + yn;
+  }
+}
+
+/*
+ *  The same filter applied down the columns of the nrow x ncol array x,
+ *  adding the result into y. Whole rows are processed together, which
+ *  vectorises along j, and each thread handles a block of columns.
+ */
+
+static void dericherows(double *x, double *y, int nrow, int ncol, deriche *f,
+                        int jlo, int jhi)
+{
+  double *work, *zero, *xr[4], *yr[5];
+  int r, j, k;
+
+  work = (double *) malloc((long) nrow*(jhi-jlo)*sizeof(double));
+  zero = (double *) calloc(jhi-jlo, sizeof(double));
+
+  if (NULL == work || NULL == zero)
+  {
+    fprintf(stderr, "dericherows: cannot allocate work arrays\n");
+    exit(-1);
+  }
+
+  /* Causal pass into work */
+
+  for (r=0; r < nrow; r++)
+  {
+    for (k=0; k < 4; k++) xr[k] = (r-k >= 0) ? &x[(long) (r-k)*ncol + jlo] : zero;
+    yr[0] = &work[(long) r*(jhi-jlo)];
+    for (k=1; k < 5; k++) yr[k] = (r-k >= 0) ? &work[(long) (r-k)*(jhi-jlo)] : zero;
+
+    for (j=0; j < jhi-jlo; j++)
+    {
+      yr[0][j] = f->np[0]*xr[0][j] + f->np[1]*xr[1][j] + f->np[2]*xr[2][j] + f->np[3]*xr[3][j]
+               - f->dd[1]*yr[1][j] - f->dd[2]*yr[2][j] - f->dd[3]*yr[3][j] - f->dd[4]*yr[4][j];
+    }
+  }
+
+  for (r=0; r < nrow; r++)
+  {
+    for (j=0; j < jhi-jlo; j++) y[(long) r*ncol + jlo+j] += work[(long) r*(jhi-jlo) + j];
+  }
+
+  /* Anti-causal pass, reusing work */
+
+  for (r=nrow-1; r >= 0; r--)
+  {
+    for (k=1; k < 5; k++) xr[k-1] = (r+k < nrow) ? &x[(long) (r+k)*ncol + jlo] : zero;
+    yr[0] = &work[(long) r*(jhi-jlo)];
+    for (k=1; k < 5; k++) yr[k] = (r+k < nrow) ? &work[(long) (r+k)*(jhi-jlo)] : zero;
+
+    for (j=0; j < jhi-jlo; j++)
+    {
+      yr[0][j] = f->nm[1]*xr[0][j] + f->nm[2]*xr[1][j] + f->nm[3]*xr[2][j] + f->nm[4]*xr[3][j]
+               - f->dd[1]*yr[1][j] - f->dd[2]*yr[2][j] - f->dd[3]*yr[3][j] - f->dd[4]*yr[4][j];
+    }
+
+    for (j=0; j < jhi-jlo; j++) y[(long) r*ncol + jlo+j] += yr[0][j];
+  }
+
+  free(work);
+  free(zero);
+}
+
+/*
+ *  Gaussian of width sigma, scaled so that its values sum to one.
+ */
+
+static void gaussfilter(double sigma, deriche *g)
+{
+  int n = 2*((int) (12.0*sigma) + 8) + 1;
+
+  double *x, *y;
+  double m0;
+  int i;
+
+  derichecoeffs(gausspar, sigma, g);
+
+  x = (double *) calloc(n, sizeof(double));
+  y = (double *) malloc(n*sizeof(double));
+
+  if (NULL == x || NULL == y)
+  {
+    fprintf(stderr, "gaussfilter: cannot allocate impulse response\n");
+    exit(-1);
+  }
+
+  x[n/2] = 1.0;
+
+  dericheline(x, y, n, g);
+
+  m0 = 0.0;
+  for (i=0; i < n; i++) m0 += y[i];
+
+  scalecoeffs(g, 1.0/m0);
+
+  free(x);
+  free(y);
+}
+
+/*
+ *  Set up the two filters for width sigma from their impulse responses.
+ *  The Gaussian is normalised to unit sum. The second derivative is
+ *  corrected to alpha*G'' + beta*G, returned in *alpha and *beta, with
+ *  beta chosen to make its sum zero, as for the exact function, and
+ *  alpha to give the best least-squares fit to the exact function. This
+ *  is more accurate than normalising the second moment, which is
+ *  dominated by the small errors in the tails.
+ */
+
+static void iirsetup(double sigma, deriche *g, deriche *g2, double *alpha, double *beta)
+{
+  int n = 2*((int) (12.0*sigma) + 8) + 1;
+  int c = n/2;
+
+  double *x, *yg, *yg2;
+  double m0g, m0, u, t, exact, uu, ue;
+  int i;
+
+  gaussfilter(sigma, g);
+  derichecoeffs(d2par, sigma, g2);
+
+  x   = (double *) calloc(n, sizeof(double));
+  yg  = (double *) malloc(n*sizeof(double));
+  yg2 = (double *) malloc(n*sizeof(double));
+
+  if (NULL == x || NULL == yg || NULL == yg2)
+  {
+    fprintf(stderr, "iirsetup: cannot allocate impulse responses\n");
+    exit(-1);
+  }
+
+  x[c] = 1.0;
+
+  dericheline(x, yg,  n, g);
+  dericheline(x, yg2, n, g2);
+
+  m0g = m0 = 0.0;
+
+  for (i=0; i < n; i++)
+  {
+    m0g += yg[i];
+    m0  += yg2[i];
+  }
+
+  uu = ue = 0.0;
+
+  for (i=0; i < n; i++)
+  {
+    t = (double) ((i-c)*(i-c))/(sigma*sigma);
+
+    exact = (t - 1.0)*exp(-0.5*t)/(sigma*sigma*sigma*sqrt(2.0*M_PI));
+
+    u = yg2[i] - (m0/m0g)*yg[i];
+
+    uu += u*u;
+    ue += u*exact;
+  }
+
+  *alpha = ue/uu;
+  *beta  = -(*alpha)*m0/m0g;
+
+  free(x);
+  free(yg);
+  free(yg2);
+}
+
+/*
+ *  The direct sum stops at a range of d, which leaves out the positive
+ *  tail of the filter. Return in *tail the sum of the missing values and
+ *  in *sigmat the width of the Gaussian with the same second moment, so
+ *  that subtracting tail times a Gaussian blur of width sigmat mimics the
+ *  truncation.
+ */
+
+static void tailsetup(filterbank *fb, double *tail, double *sigmat)
+{
+  int d = fb->d;
+  int e = d + (int) (8.0*fb->sigma);
+
+  double f, m0, m2;
+  int k, l;
+
+  m0 = m2 = 0.0;
+
+  for (k=-e; k <= e; k++)
+  {
+    for (l=-e; l <= e; l++)
+    {
+      if (abs(k) <= d && abs(l) <= d) continue;
+
+      f = filterfunc(fb->sigma, fb->filter0, k, l);
+
+      m0 += f;
+      m2 += f*(k*k+l*l);
+    }
+  }
+
+  *tail   = m0;
+  *sigmat = sqrt(m2/(2.0*m0));
+}
+
+void conviir(double *padded, double *conv, int nx, int ny, int d)
+{
+  filterbank *fb = getfilter(d);
+
+  double sigma = fb->sigma;
+  double c = -fb->filter0 * M_PI * sigma*sigma*sigma*sigma;
+
+  int nxp = nx+2*d;
+  int nyp = ny+2*d;
+
+  deriche g, g2, gt;
+  double alpha, beta, tail, sigmat;
+
+  double *a, *b, *s, *t, *line;
+  int i, j, r, jlo, jhi, nthread, thread;
+
+  iirsetup(sigma, &g, &g2, &alpha, &beta);
+  tailsetup(fb, &tail, &sigmat);
+  gaussfilter(sigmat, &gt);
+
+  a = (double *) malloc((long) nxp*ny*sizeof(double));
+  b = (double *) malloc((long) nxp*ny*sizeof(double));
+  s = (double *) calloc((long) nxp*ny, sizeof(double));
+  t = (double *) malloc((long) nxp*ny*sizeof(double));
+
+  if (NULL == a || NULL == b || NULL == s || NULL == t)
+  {
+    fprintf(stderr, "conviir: cannot allocate %d x %d work arrays\n", nxp, ny);
+    exit(-1);
+  }
+
+#pragma omp parallel \
+  shared(padded, conv, a, b, s, t, gt, tail, nx, ny, nxp, nyp, d, g, g2, alpha, beta, c) \
+  private(i, j, r, jlo, jhi, line, nthread, thread)
+  {
+    line = (double *) malloc(nyp*sizeof(double));
+
+    if (NULL == line)
+    {
+      fprintf(stderr, "conviir: cannot allocate line of %d pixels\n", nyp);
+      exit(-1);
+    }
+
+    /*
+     *  Along j: a = G*x and b = G''*x for the columns we need, with b
+     *  then replaced by the combination alpha*b + 2*beta*a which, after
+     *  the passes along i below, gives the corrected G''G + GG''. The
+     *  blur for the truncation correction goes in t, already scaled.
+     */
+
+#pragma omp for
+    for (r=0; r < nxp; r++)
+    {
+      dericheline(&padded[(long) r*nyp], line, nyp, &g);
+      for (j=0; j < ny; j++) a[(long) r*ny+j] = line[j+d];
+
+      dericheline(&padded[(long) r*nyp], line, nyp, &g2);
+      for (j=0; j < ny; j++) b[(long) r*ny+j] = alpha*line[j+d] + 2.0*beta*a[(long) r*ny+j];
+
+      dericheline(&padded[(long) r*nyp], line, nyp, &gt);
+      for (j=0; j < ny; j++) t[(long) r*ny+j] = -tail/c*line[j+d];
+    }
+
+    free(line);
+
+    /* Along i: s = alpha G''*a + G*b + Gt*t */
+
+#ifdef _OPENMP
+    nthread = omp_get_num_threads();
+    thread  = omp_get_thread_num();
+#else
+    nthread = 1;
+    thread  = 0;
+#endif
+
+    jlo = (long) ny*thread/nthread;
+    jhi = (long) ny*(thread+1)/nthread;
+
+    if (jhi > jlo)
+    {
+      dericherows(a, s, nxp, ny, &g2, jlo, jhi);
+
+      for (r=0; r < nxp; r++)
+      {
+        for (j=jlo; j < jhi; j++) s[(long) r*ny+j] = alpha*s[(long) r*ny+j];
+      }
+
+      dericherows(b, s, nxp, ny, &g, jlo, jhi);
+      dericherows(t, s, nxp, ny, &gt, jlo, jhi);
+    }
+
+#pragma omp barrier
+
+#pragma omp for
+    for (i=0; i < nx; i++)
+    {
+      for (j=0; j < ny; j++)
+      {
+        conv[(long) i*ny+j] = c*s[(long) (i+d)*ny+j];
+      }
+    }
+  }
+
+  free(a);
+  free(b);
+  free(s);
+  free(t);
+}
@@ -0,0 +1,246 @@
+/*  Explicitly vectorised direct convolution.
+ *
+ *  The loop is the same as the direct one in dosharpen, using the
+ *  precomputed coefficients, except that each vector register holds
+ *  adjacent output pixels along j. For each tap the coefficient is
+ *  broadcast to every lane and multiplied by an unaligned load of the
+ *  corresponding input pixels, so there are no shuffles and each lane
+ *  accumulates its pixel in the same order as the scalar loop.
+ *
+ *  Kernels are compiled for several x86 instruction set levels using
+ *  function attributes rather than compiler flags, so that a single
+ *  executable can run on any node; the best level supported by the
+ *  processor is chosen at run time from CPUID unless SHARPEN_ISA asks
+ *  for a particular one. The AVX2 and AVX-512 kernels use fused
+ *  multiply-adds, so their results differ from the scalar loop by
+ *  rounding. Other architectures always get the portable scalar kernel.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "sharpen.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define X86_KERNELS
+#include <immintrin.h>
+#endif
+
+static char *isanames[] = {"scalar", "SSE2", "AVX2", "AVX-512"};
+
+static int currentisa = -1;
+
+char *isaname(int isa)
+{
+  if (isa < ISA_SCALAR || isa > ISA_AVX512) return "unknown";
+
+  return isanames[isa];
+}
+
+static int isasupported(int isa)
+{
+  if (isa == ISA_SCALAR) return 1;
+
+#ifdef X86_KERNELS
+  __builtin_cpu_init();
+
+  switch (isa)
+  {
+    case ISA_SSE2:
+      return __builtin_cpu_supports("sse2");
+
+    case ISA_AVX2:
+      return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+
+    case ISA_AVX512:
+      return __builtin_cpu_supports("avx512f");
+  }
+#endif
+
+  return 0;
+}
+
+/*
+ *  Choose the instruction set for convsimd(): either the one requested,
+ *  which must be supported, or for ISA_AUTO the best one available.
+ */
+
+int selectisa(int isa)
+{
+  if (isa == ISA_AUTO)
+  {
+    for (isa = ISA_AVX512; isa > ISA_SCALAR; isa--)
+    {
+      if (isasupported(isa)) break;
+    }
+  }
+  else if (!isasupported(isa))
+  {
+    fprintf(stderr, "selectisa: %s is not supported on this processor\n", isaname(isa));
+    exit(-1);
+  }
+
+  currentisa = isa;
+
+  return isa;
+}
+
+/*
+ *  Each kernel computes output row i. The scalar loop also finishes off
+ *  the pixels j0 <= j < ny left over when ny is not a multiple of the
+ *  vector length.
+ */
+
+static void rowscalar(double *w, double *padded, double *conv,
+                      int ny, int d, int i, int j0)
+{
+  int j, k, l;
+  int nyp = ny+2*d;
+  int nw  = 2*d+1;
+  double sum;
+
+  for (j=j0; j < ny; j++)
+  {
+    sum = 0.0;
+
+    for (k=-d; k <= d; k++)
+    {
+      for (l=-d; l <= d; l++)
+      {
+        sum = sum + w[(k+d)*nw+(l+d)]*padded[(long) (i+d+k)*nyp+(j+d+l)];
+      }
+    }
+
+    conv[(long) i*ny+j] = sum;
+  }
+}
+
+#ifdef X86_KERNELS
+
+__attribute__((target("sse2")))
+static void rowsse2(double *w, double *padded, double *conv,
+                    int ny, int d, int i)
+{
+  int j, k, l;
+  int nyp = ny+2*d;
+  int nw  = 2*d+1;
+  double *in, *wk;
+  __m128d sum;
+
+  for (j=0; j+2 <= ny; j += 2)
+  {
+    sum = _mm_setzero_pd();
+
+    for (k=-d; k <= d; k++)
+    {
+      in = &padded[(long) (i+d+k)*nyp + j];
+      wk = &w[(k+d)*nw];
+
+      for (l=0; l < nw; l++)
+      {
+        sum = _mm_add_pd(sum, _mm_mul_pd(_mm_set1_pd(wk[l]), _mm_loadu_pd(&in[l])));
+      }
+    }
+
+    _mm_storeu_pd(&conv[(long) i*ny+j], sum);
+  }
+
+  rowscalar(w, padded, conv, ny, d, i, j);
+}
+
+__attribute__((target("avx2,fma")))
+static void rowavx2(double *w, double *padded, double *conv,
+                    int ny, int d, int i)
+{
+  int j, k, l;
+  int nyp = ny+2*d;
+  int nw  = 2*d+1;
+  double *in, *wk;
+  __m256d sum;
+
+  for (j=0; j+4 <= ny; j += 4)
+  {
+    sum = _mm256_setzero_pd();
+
+    for (k=-d; k <= d; k++)
+    {
+      in = &padded[(long) (i+d+k)*nyp + j];
+      wk = &w[(k+d)*nw];
+
+      for (l=0; l < nw; l++)
+      {
+        sum = _mm256_fmadd_pd(_mm256_set1_pd(wk[l]), _mm256_loadu_pd(&in[l]), sum);
+      }
+    }
+
+    _mm256_storeu_pd(&conv[(long) i*ny+j], sum);
+  }
+
+  rowscalar(w, padded, conv, ny, d, i, j);
+}
+
+__attribute__((target("avx512f")))
+static void rowavx512(double *w, double *padded, double *conv,
+                      int ny, int d, int i)
+{
+  int j, k, l;
+  int nyp = ny+2*d;
+  int nw  = 2*d+1;
+  double *in, *wk;
+  __m512d sum;
+
+  for (j=0; j+8 <= ny; j += 8)
+  {
+    sum = _mm512_setzero_pd();
+
+    for (k=-d; k <= d; k++)
+    {
+      in = &padded[(long) (i+d+k)*nyp + j];
+      wk = &w[(k+d)*nw];
+
+      for (l=0; l < nw; l++)
+      {
+        sum = _mm512_fmadd_pd(_mm512_set1_pd(wk[l]), _mm512_loadu_pd(&in[l]), sum);
+      }
+    }
+
+    _mm512_storeu_pd(&conv[(long) i*ny+j], sum);
+  }
+
+  rowscalar(w, padded, conv, ny, d, i, j);
+}
+
+#endif
+
+void convsimd(double *padded, double *conv, int nx, int ny, int d)
+{
+  double *w = getfilter(d)->w;
+  int isa, i;
+
+  if (currentisa < 0) selectisa(ISA_AUTO);
+
+  isa = currentisa;
+
+#pragma omp parallel for default(none) shared(w, padded, conv, nx, ny, d, isa) private(i)
+  for (i=0; i < nx; i++)
+  {
+    switch (isa)
+    {
+#ifdef X86_KERNELS
+      case ISA_SSE2:
+        rowsse2(w, padded, conv, ny, d, i);
+        break;
+
+      case ISA_AVX2:
+        rowavx2(w, padded, conv, ny, d, i);
+        break;
+
+      case ISA_AVX512:
+        rowavx512(w, padded, conv, ny, d, i);
+        break;
+#endif
+
+      default:
+        rowscalar(w, padded, conv, ny, d, i, 0);
+    }
+  }
+}
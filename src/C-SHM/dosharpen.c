@@ -40,6 +40,15 @@ void dosharpen(char *infile, int nx, int ny)
   /* Sets the linear range of the sharpen filter as measured from any given pixel:
      only pixels within a (2d+1)*(2d+1) square centered on the pixel are used to 
      compute its new value. */
+
+  if (2*d >= nx || 2*d >= ny)
+    {
+      if (shmem_my_pe() == 0) printf("Error: a %d x %d image is too small for a filter of range %d\n", nx, ny, d);
+      fflush(stdout);
+
+      shmem_finalize();
+      exit(-1);
+    }
   
   double  norm = (2*d-1)*(2*d-1);  
   double scale = 2.0;
@@ -48,6 +57,7 @@ void dosharpen(char *infile, int nx, int ny)
   int pixcount, numput;
 
   int i, j, k, l;
+  double *w;
   double tstart, tstop, time;
 
   double fuzzyPadded[nx+2*d][ny+2*d];  /* Will store the fuzzy input image plus additional border padding                                         */
@@ -157,6 +167,9 @@ void dosharpen(char *infile, int nx, int ny)
 
   tstart = wtime();
 
+  /* Use the precomputed coefficients rather than calling filter() for every tap */
+  w = getfilter(d)->w;
+
   pixcount = 0;
 
   for (i=0; i < nx; i++)
@@ -171,7 +184,7 @@ void dosharpen(char *infile, int nx, int ny)
                 {
                   for (l= -d; l <= d; l++)
                     {
-                      convolution[i][j] = convolution[i][j] + filter(d,k,l)*fuzzyPadded[i+d+k][j+d+l];
+                      convolution[i][j] = convolution[i][j] + w[(k+d)*(2*d+1)+(l+d)]*fuzzyPadded[i+d+k][j+d+l];
                     }
                 }
             }
@@ -245,6 +258,8 @@ void dosharpen(char *infile, int nx, int ny)
       printf("Calculation time was %f seconds\n", time);
       fflush(stdout);
     }
+
+  freefilterbanks();
 }
 
 
@@ -0,0 +1,115 @@
+/*  Cache of precomputed filter coefficients.
+ *
+ *  Calling filter() for every tap of every pixel costs (2d+1)*(2d+1)
+ *  evaluations of exp() per pixel, all of which give the same answers
+ *  for every pixel. Here the whole table is built once for each
+ *  combination of (d, sigma, filter0) and kept for the rest of the run
+ *  so that the convolution loops only do a lookup.
+ *
+ *  The coefficients are stored contiguously in row-major order, i.e.
+ *  the weight for the offset (k,l) is w[(k+d)*(2*d+1) + (l+d)], with
+ *  the start of the table aligned to a cache line. The same values are
+ *  also kept in single precision in wf.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "sharpen.h"
+
+#define MAXFILTERBANK 64
+#define FILTERALIGN   64
+
+static filterbank bank[MAXFILTERBANK];
+static int nbank = 0;
+
+static void buildfilterbank(filterbank *fb, int d, double sigma, double filter0)
+{
+  int k, l, n;
+
+  n = 2*d+1;
+
+  if (0 != posix_memalign((void **) &fb->w,  FILTERALIGN, n*n*sizeof(double)) ||
+      0 != posix_memalign((void **) &fb->wf, FILTERALIGN, n*n*sizeof(float)))
+  {
+    fprintf(stderr, "getfilterbank: cannot allocate %d x %d coefficients\n", n, n);
+    exit(-1);
+  }
+
+  for (k=-d; k <= d; k++)
+  {
+    for (l=-d; l <= d; l++)
+    {
+      fb->w[(k+d)*n + (l+d)]  = filterfunc(sigma, filter0, k, l);
+      fb->wf[(k+d)*n + (l+d)] = (float) fb->w[(k+d)*n + (l+d)];
+    }
+  }
+
+  fb->d       = d;
+  fb->sigma   = sigma;
+  fb->filter0 = filter0;
+}
+
+/*
+ *  Return the coefficient table for the given parameters, building it
+ *  on first use. The returned pointer remains valid until the next
+ *  call of freefilterbanks().
+ */
+
+filterbank *getfilterbank(int d, double sigma, double filter0)
+{
+  filterbank *fb = NULL;
+  int i;
+
+#pragma omp critical (filterbank)
+  {
+    for (i=0; i < nbank; i++)
+    {
+      if (bank[i].d == d && bank[i].sigma == sigma && bank[i].filter0 == filter0)
+      {
+        fb = &bank[i];
+        break;
+      }
+    }
+
+    if (NULL == fb)
+    {
+      if (nbank == MAXFILTERBANK)
+      {
+        fprintf(stderr, "getfilterbank: more than %d filters requested\n", MAXFILTERBANK);
+        exit(-1);
+      }
+
+      fb = &bank[nbank];
+      buildfilterbank(fb, d, sigma, filter0);
+      nbank++;
+    }
+  }
+
+  return fb;
+}
+
+/*
+ *  Coefficients of the standard sharpening filter of range d, i.e. the
+ *  same values as returned by filter(d, k, l).
+ */
+
+filterbank *getfilter(int d)
+{
+  return getfilterbank(d, filtersigma(d), filterpeak());
+}
+
+void freefilterbanks(void)
+{
+  int i;
+
+#pragma omp critical (filterbank)
+  {
+    for (i=0; i < nbank; i++)
+    {
+      free(bank[i].w);
+      free(bank[i].wf);
+    }
+
+    nbank = 0;
+  }
+}
@@ -8,3 +8,21 @@ void pgmwrite(char *filename, void *vx, int nx, int ny);
 
 void dosharpen(char *filename, int nx, int ny);
 double filter(int d, int i, int j);
+
+/* Precomputed filter coefficients, see filterbank.c */
+
+typedef struct
+{
+  int d;
+  double sigma, filter0;
+  double *w;
+  float *wf;
+} filterbank;
+
+double filtersigma(int d);
+double filterpeak(void);
+double filterfunc(double sigma, double filter0, int i, int j);
+
+filterbank *getfilterbank(int d, double sigma, double filter0);
+filterbank *getfilter(int d);
+void freefilterbanks(void);